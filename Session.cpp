@@ -5,186 +5,473 @@
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
+#include <iostream>
 #include <mutex>
 #include <optional>
 #include <queue>
 #include <shared_mutex>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "includes/skinny.pb.h"
+#include "profile.h"
 namespace session {
 class Db;
-class KAThread {
+class Lease;
+
+using Clock = std::chrono::steady_clock;
+
+// A lease is renewed by every KeepAlive and event, and ends this long after
+// the last one. A KeepAlive still pending then is answered empty.
+constexpr auto kLeaseTimeout = std::chrono::seconds(5);
+// Lease a new leader gives every session: longer than a client may take to
+// give up on the old leader (its KeepAlive deadline) and find the new one.
+constexpr auto kFailoverGrace = std::chrono::seconds(15);
+
+// Per-session recovery latencies after a leader change: how long each
+// restored session took to send its first KeepAlive to the new leader.
+// Every restored session counts once: recovered, expired, or ended (or
+// given another lease) before either.
+class RecoveryTracker {
  public:
-  KAThread(int sid, const std::function<void(int)> &expire_cb)
-      : sid_(sid),
-        expire_cb_(expire_cb),
-        t_([this] {
-          using namespace std::chrono_literals;
-          std::mutex lock;
-          while (true) {
-            std::unique_lock ul(lock);
-            auto ret = cv_.wait_for(ul, 5s);
-            // will wake if received new keepalive, or new event, or cancelled
-            // or timeout
-            if (cancelled_.load()) {
-              std::cout << "KAThread " << sid_ << " exited\n";
-              return;
-            }
-            {
-              std::lock_guard lg(reactor_lock_);
-              if (reactor_ && res_) {
-                // If have active keepalive
-                if (ret == std::cv_status::timeout) {
-                  //  timeout => ack keepalive
-                  reactor_->Finish(grpc::Status::OK);
-                  reactor_ = nullptr;
-                  res_ = nullptr;
-                } else if (std::lock_guard lg(event_queue_lock_);
-                           !event_queue_.empty()) {
-                  // Got event => return event
-                  res_->set_event_id(event_queue_.front().first);
-                  res_->set_fh(event_queue_.front().second);
-                  event_queue_.pop();
-                  reactor_->Finish(grpc::Status::OK);
-                  reactor_ = nullptr;
-                  res_ = nullptr;
-                }
-                // wake due to new keep alive => do nothing
-              } else if (ret == std::cv_status::timeout) {
-                std::cout << "calling expire callback" << std::endl;
-                cancel();
-                // no active keepalive and timeout => call expired callback
-                std::invoke(expire_cb_, sid_);
-              }
-              // Other cases:
-              // 1. no active keep alive but got event => do nothing
-              // 2. no active keep alive and received new keepalive => not
-              // gonna happen
-            }
-          }
-        }),
-        res_(nullptr),
-        reactor_(nullptr) {}
-
-  ~KAThread() {
-    cancel();
-    t_.join();
+  RecoveryTracker(int sessions, Clock::time_point start)
+      : pending_(sessions), start_(start) {}
+
+  void recovered() {
+    std::lock_guard lg(mutex_);
+    latencies_.push_back(Clock::now() - start_);
+    done();
+  }
+  void expired() {
+    std::lock_guard lg(mutex_);
+    ++expired_;
+    done();
+  }
+  void ended() {
+    std::lock_guard lg(mutex_);
+    ++ended_;
+    done();
   }
 
-  void set_reactor(grpc::ServerUnaryReactor *reactor, skinny::Event *res,
-                   int acked_eid) {
+ private:
+  // Called with mutex_ held
+  void done() {
+    if (--pending_ == 0) report();
+  }
+
+  void report() {
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+    std::sort(latencies_.begin(), latencies_.end());
+    auto at = [this](int percent) {
+      if (latencies_.empty()) return 0L;
+      auto i =
+          std::min(latencies_.size() - 1, latencies_.size() * percent / 100);
+      return static_cast<long>(
+          duration_cast<milliseconds>(latencies_[i]).count());
+    };
+    std::cout << "Session recovery: " << latencies_.size() << " recovered, "
+              << expired_ << " expired, " << ended_ << " ended, latency p50 "
+              << at(50) << "ms p99 " << at(99) << "ms max " << at(100) << "ms"
+              << std::endl;
+  }
+
+  std::mutex mutex_;
+  int pending_;
+  int expired_ = 0;
+  int ended_ = 0;
+  std::vector<Clock::duration> latencies_;
+  const Clock::time_point start_;
+};
+
+// One thread keeping the lease deadlines of every session. A lease has at
+// most one timer queued; renewing it only moves its deadline, and the timer
+// is queued again for the new deadline when it fires.
+class LeaseTimers {
+ public:
+  LeaseTimers() : t_([this] { run(); }) {}
+  ~LeaseTimers() {
     {
-      std::lock_guard lg(reactor_lock_);
-      reactor_ = reactor;
-      res_ = res;
+      std::lock_guard lg(mutex_);
+      stopped_ = true;
     }
+    cv_.notify_one();
+    t_.join();
+  }
+
+  void add(const std::shared_ptr<Lease> &lease, Clock::time_point at) {
+    add_all({{at, lease}});
+  }
+
+  // Queues many timers under one lock, for a leader change
+  void add_all(std::vector<std::pair<Clock::time_point, std::weak_ptr<Lease>>>
+                   &&timers) {
     {
-      std::lock_guard lg(us_lock_);
-      acked_events.insert(acked_eid);
-      ack_event_cv_.notify_all();
+      std::lock_guard lg(mutex_);
+      for (auto &[at, lease] : timers) queue_.push({at, std::move(lease)});
     }
     cv_.notify_one();
   }
 
-  int enqueue_event(int fh) {
-    int new_eid = event_id++;
+  size_t size() {
+    std::lock_guard lg(mutex_);
+    return queue_.size();
+  }
+
+ private:
+  struct Timer {
+    Clock::time_point at;
+    std::weak_ptr<Lease> lease;
+    bool operator>(const Timer &other) const { return at > other.at; }
+  };
+
+  void run();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<>> queue_;
+  bool stopped_ = false;
+  std::thread t_;
+};
+
+// The leader's side of a session: answers its KeepAlive long-poll, delivers
+// its events, and expires it once its lease runs out.
+class Lease {
+ public:
+  Lease(int sid, const std::function<void(int)> &expire_cb,
+        Clock::time_point deadline,
+        std::shared_ptr<RecoveryTracker> recovery = nullptr)
+      : sid_(sid),
+        expire_cb_(expire_cb),
+        deadline_(deadline),
+        recovery_(std::move(recovery)) {}
+
+  // Parks the KeepAlive until an event or the lease deadline, unless
+  // `answer_now`
+  void set_reactor(grpc::ServerUnaryReactor *reactor, skinny::Event *res,
+                   int acked_eid, bool answer_now) {
+    std::shared_ptr<RecoveryTracker> recovered;
     {
-      std::lock_guard l(event_queue_lock_);
-      event_queue_.push({new_eid, fh});
+      std::lock_guard lg(mutex_);
+      if (cancelled_) {
+        reactor->Finish(grpc::Status::OK);
+        return;
+      }
+      reactor_ = reactor;
+      res_ = res;
+      deadline_ = Clock::now() + kLeaseTimeout;
+      acked_events.insert(acked_eid);
+      recovered.swap(recovery_);
+      deliver();
+      if (answer_now && reactor_) {
+        reactor_->Finish(grpc::Status::OK);
+        reactor_ = nullptr;
+        res_ = nullptr;
+      }
     }
-    cv_.notify_one();
-    return new_eid;
+    ack_event_cv_.notify_all();
+    if (recovered) recovered->recovered();
+  }
+
+  int enqueue_event(int fh, uint64_t log_idx) {
+    skinny::Event event;
+    event.set_fh(fh);
+    event.set_log_idx(log_idx);
+    return enqueue(std::move(event));
+  }
+
+  int enqueue_path_event(const std::string &path, uint64_t log_idx) {
+    skinny::Event event;
+    event.set_path(path);
+    event.set_log_idx(log_idx);
+    return enqueue(std::move(event));
+  }
+
+  // Events not yet sent to the client
+  size_t queue_depth() {
+    std::lock_guard lg(mutex_);
+    return event_queue_.size();
   }
 
   void block_until_event_acked(int eid) {
-    std::unique_lock lk(us_lock_);
-    while (!acked_events.contains(eid) && !cancelled_.load()) {
-      ack_event_cv_.wait(lk);
-    }
+    std::unique_lock lk(mutex_);
+    ack_event_cv_.wait(
+        lk, [&] { return acked_events.contains(eid) || cancelled_; });
     acked_events.erase(eid);
   }
 
- private:
-  std::mutex reactor_lock_, event_queue_lock_, us_lock_;
-  std::condition_variable cv_, ack_event_cv_;
-  std::atomic<bool> cancelled_;
-  grpc::ServerUnaryReactor *reactor_;
-  std::queue<std::pair<int, int>> event_queue_;  // <event_id, fh>
-  int event_id;
-  std::unordered_set<int> acked_events;
-  skinny::Event *res_;
-  const std::function<void(int)> &expire_cb_;
-  int sid_;
-  std::thread t_;
+  // Called by LeaseTimers when a deadline of this lease passed. Returns the
+  // deadline to fire at next, if any.
+  std::optional<Clock::time_point> on_timer(Clock::time_point now) {
+    std::shared_ptr<RecoveryTracker> recovery;
+    {
+      std::lock_guard lg(mutex_);
+      if (cancelled_) return std::nullopt;
+      if (now < deadline_) return deadline_;  // renewed since
+      if (reactor_) {
+        // Answer the KeepAlive, which the client renews at once
+        reactor_->Finish(grpc::Status::OK);
+        reactor_ = nullptr;
+        res_ = nullptr;
+        deadline_ = now + kLeaseTimeout;
+        return deadline_;
+      }
+      cancelled_ = true;
+      recovery.swap(recovery_);
+    }
+    ack_event_cv_.notify_all();
+    if (recovery) recovery->expired();
+    std::invoke(expire_cb_, sid_);
+    return std::nullopt;
+  }
 
+  // Stops the lease; a pending KeepAlive is answered empty
   void cancel() {
-    cancelled_.store(1);
-    cv_.notify_one();
+    std::shared_ptr<RecoveryTracker> recovery;
+    {
+      std::lock_guard lg(mutex_);
+      cancelled_ = true;
+      if (reactor_) reactor_->Finish(grpc::Status::OK);
+      reactor_ = nullptr;
+      res_ = nullptr;
+      recovery.swap(recovery_);
+    }
     ack_event_cv_.notify_all();
+    if (recovery) recovery->ended();
+  }
+
+ private:
+  int enqueue(skinny::Event &&event) {
+    std::lock_guard lg(mutex_);
+    int new_eid = event_id++;
+    event.set_event_id(new_eid);
+    event_queue_.push(std::move(event));
+    deliver();
+    return new_eid;
   }
 
-  int pop_event() {
-    std::lock_guard l(event_queue_lock_);
-    assert(!event_queue_.empty());
-    int fh = event_queue_.front().second;
+  // Answers the pending KeepAlive with the oldest event, if both exist.
+  // Called with mutex_ held.
+  void deliver() {
+    if (!reactor_ || event_queue_.empty()) return;
+    auto term = res_->term();
+    *res_ = std::move(event_queue_.front());
+    res_->set_term(term);
     event_queue_.pop();
-    return fh;
+    reactor_->Finish(grpc::Status::OK);
+    reactor_ = nullptr;
+    res_ = nullptr;
+    deadline_ = Clock::now() + kLeaseTimeout;
   }
+
+  std::mutex mutex_;
+  std::condition_variable ack_event_cv_;
+  bool cancelled_ = false;
+  grpc::ServerUnaryReactor *reactor_ = nullptr;
+  skinny::Event *res_ = nullptr;
+  std::queue<skinny::Event> event_queue_;
+  int event_id = 0;
+  std::unordered_set<int> acked_events;
+  const int sid_;
+  const std::function<void(int)> &expire_cb_;
+  Clock::time_point deadline_;
+  std::shared_ptr<RecoveryTracker> recovery_;  // until the first KeepAlive
 };
 
+inline void LeaseTimers::run() {
+  std::unique_lock ul(mutex_);
+  while (!stopped_) {
+    if (queue_.empty()) {
+      cv_.wait(ul);
+      continue;
+    }
+    auto now = Clock::now();
+    if (auto at = queue_.top().at; now < at) {
+      cv_.wait_until(ul, at);
+      continue;
+    }
+    auto lease = queue_.top().lease.lock();
+    queue_.pop();
+    if (!lease) continue;
+    ul.unlock();
+    std::optional<Clock::time_point> next;
+    {
+      profile::Span span("lease_timer");
+      next = lease->on_timer(now);
+    }
+    ul.lock();
+    if (next) queue_.push({*next, lease});
+  }
+}
+
 class Entry {
  public:
   int id;
 
-  Entry(const std::function<void(int)> &cb)
-      : id(next_id.fetch_add(1, std::memory_order_relaxed)), cb(cb) {}
+  Entry(const std::function<void(int)> &cb, LeaseTimers &timers)
+      : id(next_id.fetch_add(1, std::memory_order_relaxed)),
+        cb(cb),
+        timers_(timers) {}
+
+  ~Entry() {
+    std::cout << "Destruct session entry" << std::endl;
+    if (lease_) lease_->cancel();
+  }
+
+  // Starts a lease on this server, which just became the session's leader
+  void start_lease(Clock::time_point deadline = Clock::now() + kLeaseTimeout) {
+    timers_.add(new_lease(deadline), deadline);
+  }
 
-  ~Entry() { std::cout << "Destruct session entry" << std::endl; }
+  // Replaces the lease without queueing its timer; see Db::restore_leases
+  std::shared_ptr<Lease> new_lease(
+      Clock::time_point deadline,
+      std::shared_ptr<RecoveryTracker> recovery = nullptr) {
+    auto lease = std::make_shared<Lease>(id, cb, deadline, std::move(recovery));
+    std::shared_ptr<Lease> old;
+    {
+      std::unique_lock lk(kalock_);
+      old = std::exchange(lease_, lease);
+    }
+    if (old) old->cancel();
+    return lease;
+  }
 
-  void start_kathread() {
-    std::unique_lock lk(kalock_);
-    kathread = std::make_unique<KAThread>(id, cb);
+  // This server stopped being the session's leader
+  void end_lease() {
+    std::shared_ptr<Lease> old;
+    {
+      std::unique_lock lk(kalock_);
+      old = std::exchange(lease_, nullptr);
+    }
+    if (old) old->cancel();
   }
 
+  // A file handle is a slot index tagged with the slot's generation. Closed
+  // slots are recycled, and the generation tag keeps a stale handle from
+  // aliasing the newer handle that reuses its slot.
   int add_new_handle(std::string path, int instance_num) {
-    v.push_back(path);
-    inum.push_back(instance_num);
-    return v.size() - 1;
+    int slot;
+    if (free_slots.empty()) {
+      slot = slots.size();
+      assert(slot <= kSlotMask);
+      ++key_open_count[path];
+      slots.push_back({std::move(path), instance_num, 0});
+    } else {
+      slot = free_slots.back();
+      free_slots.pop_back();
+      auto &h = slots[slot];
+      ++key_open_count[path];
+      h = {std::move(path), instance_num, (h.gen + 1) & kGenMask};
+    }
+    ++open_count;
+    return (slots[slot].gen << kSlotBits) | slot;
+  }
+  void close_handle(int fh) {
+    if (!is_valid_handle(fh) || slots[fh & kSlotMask].inum == -1) return;
+    auto &h = slots[fh & kSlotMask];
+    h.inum = -1;
+    if (auto it = key_open_count.find(h.path); --it->second == 0) {
+      key_open_count.erase(it);
+    }
+    free_slots.push_back(fh & kSlotMask);
+    --open_count;
+  }
+  // Another open handle of this session to `key`, if any
+  std::optional<int> find_open_handle(const std::string &key) const {
+    if (!key_open_count.contains(key)) return std::nullopt;
+    for (int i = 0; i < slots.size(); ++i) {
+      if (slots[i].inum != -1 && slots[i].path == key)
+        return (slots[i].gen << kSlotBits) | i;
+    }
+    return std::nullopt;
+  }
+  // Whether fh was returned by add_new_handle and its slot not reused since.
+  bool is_valid_handle(int fh) const {
+    return fh >= 0 && (fh & kSlotMask) < slots.size() &&
+           slots[fh & kSlotMask].gen == (fh >> kSlotBits);
+  }
+  int handle_count() const {
+    return open_count.load(std::memory_order_relaxed);
+  }
+  std::vector<int> open_handles() const {
+    std::vector<int> fhs;
+    fhs.reserve(open_count);
+    for (int i = 0; i < slots.size() && fhs.size() < open_count; ++i) {
+      if (slots[i].inum != -1) fhs.push_back((slots[i].gen << kSlotBits) | i);
+    }
+    return fhs;
+  }
+  // -1 if the handle is closed or invalid
+  const int &handle_inum(int fh) {
+    static const int closed = -1;
+    return is_valid_handle(fh) ? slots[fh & kSlotMask].inum : closed;
+  }
+
+  // A closed handle still maps to its file until its slot is reused.
+  const std::string &fh_to_key(int fh) const {
+    if (!is_valid_handle(fh)) throw std::out_of_range("Invalid file handle");
+    return slots[fh & kSlotMask].path;
   }
-  void close_handle(int fh) { inum.at(fh) = -1; }
-  int handle_count() const { return v.size(); }
-  const int &handle_inum(int fh) { return inum.at(fh); }
 
-  const std::string &fh_to_key(int fh) const { return v.at(fh); }
+  std::optional<int> enqueue_event(int fh, uint64_t log_idx) {
+    std::shared_lock lk(kalock_);
+    if (lease_) return lease_->enqueue_event(fh, log_idx);
+    return std::nullopt;
+  }
 
-  std::optional<int> enqueue_event(int fh) {
+  std::optional<int> enqueue_path_event(const std::string &path,
+                                        uint64_t log_idx) {
     std::shared_lock lk(kalock_);
-    if (kathread) return kathread->enqueue_event(fh);
+    if (lease_) return lease_->enqueue_path_event(path, log_idx);
     return std::nullopt;
   }
 
   void set_reactor(grpc::ServerUnaryReactor *reactor, skinny::Event *res,
-                   int acked_eid) {
+                   int acked_eid, bool answer_now) {
     std::shared_lock lk(kalock_);
-    if (kathread) kathread->set_reactor(reactor, res, acked_eid);
+    if (lease_) {
+      lease_->set_reactor(reactor, res, acked_eid, answer_now);
+    } else {
+      reactor->Finish(grpc::Status::OK);
+    }
   }
 
   void block_until_event_acked(int eid) {
     std::shared_lock lk(kalock_);
-    if (kathread) kathread->block_until_event_acked(eid);
+    if (lease_) lease_->block_until_event_acked(eid);
+  }
+
+  size_t event_queue_depth() {
+    std::shared_lock lk(kalock_);
+    return lease_ ? lease_->queue_depth() : 0;
   }
 
  private:
-  std::vector<std::string> v;
-  std::vector<int> inum;  // instance_num
+  struct Handle {
+    std::string path;
+    int inum;  // instance_num, -1 once closed
+    int gen;
+  };
+  static constexpr int kSlotBits = 20;
+  static constexpr int kSlotMask = (1 << kSlotBits) - 1;
+  static constexpr int kGenMask = (1 << (31 - kSlotBits)) - 1;
+  std::vector<Handle> slots;
+  std::vector<int> free_slots;
+  std::atomic<int> open_count{0};  // read by Db::stats without the apply lock
+  std::unordered_map<std::string, int> key_open_count;
   static std::atomic<int> inline next_id{0};
   const std::function<void(int)> &cb;
-  std::unique_ptr<KAThread> kathread;
+  LeaseTimers &timers_;
+  std::shared_ptr<Lease> lease_;
   std::shared_mutex kalock_;
 };
 
@@ -192,12 +479,13 @@ class Db {
   std::unordered_map<int, std::shared_ptr<Entry>> session_db;
   std::mutex db_lock;
   std::function<void(int)> expire_cb_;
+  LeaseTimers timers_;
 
  public:
   Db(const std::function<void(int)> &cb) : expire_cb_(cb) {}
 
   std::shared_ptr<Entry> create_session() {
-    auto session = std::make_shared<Entry>(expire_cb_);
+    auto session = std::make_shared<Entry>(expire_cb_, timers_);
     {
       std::lock_guard lg(db_lock);
       session_db[session->id] = session;
@@ -218,9 +506,75 @@ class Db {
     session_db.erase(it);
   }
 
-  void start_kathread() {
-    std::lock_guard lg(db_lock);
-    for (auto &it : session_db) it.second->start_kathread();
+  struct Stats {
+    size_t sessions = 0;
+    size_t open_handles = 0;
+    size_t lease_timers = 0;
+    size_t event_queue_depth = 0;
+    size_t max_event_queue_depth = 0;
+  };
+
+  // Walks every session, so it is for diagnostics only. Needs no apply lock:
+  // it reads only counters and queues that have locks of their own.
+  Stats stats() {
+    std::vector<std::shared_ptr<Entry>> sessions;
+    {
+      std::lock_guard lg(db_lock);
+      sessions.reserve(session_db.size());
+      for (auto &it : session_db) sessions.push_back(it.second);
+    }
+    Stats stats;
+    stats.sessions = sessions.size();
+    stats.lease_timers = timers_.size();
+    for (auto &session : sessions) {
+      auto depth = session->event_queue_depth();
+      stats.open_handles += session->handle_count();
+      stats.event_queue_depth += depth;
+      stats.max_event_queue_depth =
+          std::max(stats.max_event_queue_depth, depth);
+    }
+    return stats;
+  }
+
+  // Gives every session a lease on this server, which just became the
+  // leader, with kFailoverGrace for its client to find it. The sessions are
+  // copied out first, so db_lock is not held while leases are made, and all
+  // timers are queued at once. Recovery latencies are printed once every
+  // session has sent a KeepAlive or expired.
+  void restore_leases() {
+    auto start = Clock::now();
+    std::vector<std::shared_ptr<Entry>> sessions;
+    {
+      std::lock_guard lg(db_lock);
+      sessions.reserve(session_db.size());
+      for (auto &it : session_db) sessions.push_back(it.second);
+    }
+    if (sessions.empty()) return;
+    auto recovery = std::make_shared<RecoveryTracker>(sessions.size(), start);
+    auto deadline = start + kFailoverGrace;
+    std::vector<std::pair<Clock::time_point, std::weak_ptr<Lease>>> timers;
+    timers.reserve(sessions.size());
+    for (auto &session : sessions) {
+      timers.emplace_back(deadline, session->new_lease(deadline, recovery));
+    }
+    timers_.add_all(std::move(timers));
+    std::cout << "Restored " << sessions.size() << " session leases in "
+              << std::chrono::duration_cast<std::chrono::microseconds>(
+                     Clock::now() - start)
+                     .count()
+              << "us" << std::endl;
+  }
+
+  // Ends the leases of this server, which stopped being the leader, so that
+  // the KeepAlives parked here are answered now and go on to the new leader
+  void end_leases() {
+    std::vector<std::shared_ptr<Entry>> sessions;
+    {
+      std::lock_guard lg(db_lock);
+      sessions.reserve(session_db.size());
+      for (auto &it : session_db) sessions.push_back(it.second);
+    }
+    for (auto &session : sessions) session->end_lease();
   }
 };
 }  // namespace session
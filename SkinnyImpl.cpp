@@ -14,6 +14,7 @@
 #include <exception>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <thread>
 #include <unordered_set>
@@ -23,20 +24,273 @@
 #include "buffer_serializer.hxx"
 #include "includes/skinny.grpc.pb.h"
 #include "includes/skinny.pb.h"
+#include "profile.h"
+#include "stats.h"
 #include "utils.h"
 
 using grpc::ServerContext;
 using grpc::ServerUnaryReactor;
 using grpc::Status;
 
+// Sends a cache invalidation for `key` to its subscribers and one-shot path
+// watchers, and blocks until every live session has acked it. `log_idx` is a
+// log index the change is applied at, so that clients reading from an
+// observer can wait for it to get there.
+void notify_events(DataStore &ds, session::Db &sdb, const std::string &key,
+                   uint64_t log_idx) {
+  profile::Span span("notify_events");
+  ScopedTimer timer(stats::fanout);
+  auto &meta = ds.at(key).first;
+  std::vector<std::thread> vt;
+  auto wait_for_ack = [&vt](std::shared_ptr<session::Entry> session,
+                            std::optional<int> eid) {
+    if (eid) {
+      stats::invalidations_sent.add();
+      vt.emplace_back([session, eid = eid.value()]() {
+        session->block_until_event_acked(eid);
+      });
+    }
+  };
+  for (auto it = meta.subscribers.begin(); it != meta.subscribers.end();) {
+    auto session = sdb.find_session(it->first);
+    if (session && session->handle_inum(it->second) != -1) {
+      wait_for_ack(session, session->enqueue_event(it->second, log_idx));
+      it++;
+    } else {
+      it = meta.subscribers.erase(it);
+    }
+  }
+  std::unordered_set<int> watchers;
+  {
+    std::lock_guard lg(meta.watchers_mutex);
+    watchers.swap(meta.path_watchers);
+  }
+  for (int sid : watchers) {
+    if (auto session = sdb.find_session(sid)) {
+      wait_for_ack(session, session->enqueue_path_event(key, log_idx));
+    }
+  }
+  for (auto &t : vt) {
+    t.join();
+  }
+}
+
+// Appends `action`, a batch of `ops` operations, to the log and waits for it
+// to commit
+template <typename Action>
+auto append(nuraft::raft_server &raft, const Action &action, size_t ops = 1) {
+  profile::Span span("append_entries");
+  stats::proposal_ops.record(ops);
+  ScopedTimer timer(stats::append);
+  return raft.append_entries({action.serialize()});
+}
+
+// Ends expired sessions in batches: the expirations arriving within
+// kBatchWindow of the first one are committed as one EndSessionsAction, so
+// an expiry storm adds a few log entries rather than one per session.
+class SessionReaper {
+ public:
+  SessionReaper(std::shared_ptr<nuraft::raft_server> raft,
+                std::shared_ptr<DataStore> ds, std::shared_ptr<session::Db> sdb)
+      : raft_(raft), ds_(ds), sdb_(sdb), t_([this] { run(); }) {}
+  ~SessionReaper() {
+    {
+      std::lock_guard lg(mutex_);
+      stopped_ = true;
+    }
+    cv_.notify_one();
+    t_.join();
+  }
+
+  void expire(int session_id) {
+    {
+      std::lock_guard lg(mutex_);
+      pending_.push_back(session_id);
+    }
+    cv_.notify_one();
+  }
+
+ private:
+  static constexpr auto kBatchWindow = std::chrono::milliseconds(20);
+  static constexpr int kMaxBatch = 4096;
+  static constexpr auto kMinRetryBackoff = std::chrono::milliseconds(10);
+  static constexpr auto kMaxRetryBackoff = std::chrono::milliseconds(1000);
+
+  void run() {
+    std::unique_lock ul(mutex_);
+    while (true) {
+      cv_.wait(ul, [this] { return stopped_ || !pending_.empty(); });
+      if (stopped_) return;
+      cv_.wait_for(ul, kBatchWindow, [this] { return stopped_; });
+      while (!pending_.empty()) {
+        auto end =
+            pending_.begin() + std::min<size_t>(pending_.size(), kMaxBatch);
+        action::EndSessionsAction action;
+        action.session_ids.assign(pending_.begin(), end);
+        pending_.erase(pending_.begin(), end);
+        ul.unlock();
+        end_sessions(action);
+        ul.lock();
+      }
+    }
+  }
+
+  // Retried with backoff while this server is leader; ending a session
+  // twice is a no-op. A batch that finds this server no longer leader is
+  // left to the next leader: becoming leader gives every session a new
+  // lease (Db::restore_leases), so these expire there unless their clients
+  // reach it.
+  void end_sessions(const action::EndSessionsAction &action) {
+    auto backoff = kMinRetryBackoff;
+    while (raft_->is_leader()) {
+      auto ret = append(*raft_, action, action.session_ids.size());
+      if (ret->get_accepted() && ret->get_result_code() == nuraft::OK) {
+        action::EndSessionsReturn r(*ret->get());
+        std::cout << "Ended " << r.ended << " expired sessions" << std::endl;
+        for (auto &path : r.notify_paths) {
+          notify_events(*ds_, *sdb_, path, raft_->get_committed_log_idx());
+        }
+        return;
+      }
+      std::unique_lock ul(mutex_);
+      if (cv_.wait_for(ul, backoff, [this] { return stopped_; })) return;
+      backoff = std::min(backoff * 2, kMaxRetryBackoff);
+    }
+  }
+
+  std::shared_ptr<nuraft::raft_server> raft_;
+  std::shared_ptr<DataStore> ds_;
+  std::shared_ptr<session::Db> sdb_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<int> pending_;
+  bool stopped_ = false;
+  std::thread t_;
+};
+
+// Connections from this server to the others, to forward calls to the leader
+class LeaderStubs {
+ public:
+  explicit LeaderStubs(std::shared_ptr<nuraft::raft_server> raft)
+      : raft_(raft) {}
+
+  // nullptr if there is no leader, or this server is the leader
+  skinny::Skinny::Stub *stub() {
+    auto *conn = leader();
+    return conn ? conn->stub.get() : nullptr;
+  }
+  skinny::SkinnyCb::Stub *stub_cb() {
+    auto *conn = leader();
+    return conn ? conn->stub_cb.get() : nullptr;
+  }
+
+  // Set on a forwarded call, which is not forwarded again. During an election
+  // two servers could otherwise send a call back and forth.
+  static constexpr char kForwardedKey[] = "skinny-forwarded";
+
+ private:
+  struct Conn {
+    std::shared_ptr<grpc::Channel> channel;
+    std::unique_ptr<skinny::Skinny::Stub> stub;
+    std::unique_ptr<skinny::SkinnyCb::Stub> stub_cb;
+  };
+
+  // Connections are created on first use and kept for the server's lifetime
+  Conn *leader() {
+    int id = raft_->get_leader();
+    if (id < 0 || id == raft_->get_id()) return nullptr;
+    std::lock_guard lg(mutex_);
+    auto &conn = conns_[id];
+    if (!conn) {
+      auto config = raft_->get_srv_config(id);
+      if (!config) return nullptr;
+      auto [host, port] = split_endpoint(config->get_endpoint());
+      auto channel = grpc::CreateChannel(host + ":" + std::to_string(port + 1),
+                                         grpc::InsecureChannelCredentials());
+      conn.reset(new Conn{channel, skinny::Skinny::NewStub(channel),
+                          skinny::SkinnyCb::NewStub(channel)});
+    }
+    return conn.get();
+  }
+
+  std::shared_ptr<nuraft::raft_server> raft_;
+  std::mutex mutex_;
+  std::unordered_map<int, std::unique_ptr<Conn>> conns_;
+};
+
+// Reads are served by the leader and by observers (Raft learners), which
+// apply the same log but do not vote. Other servers forward every call to the
+// leader, so a client can stay with the server nearest to it.
 class SkinnyImpl final : public skinny::Skinny::Service {
  public:
   explicit SkinnyImpl(std::shared_ptr<nuraft::raft_server> raft,
                       std::shared_ptr<DataStore> ds,
-                      std::shared_ptr<session::Db> sdb)
-      : raft_(raft), ds_(ds), sdb_(sdb){};
+                      std::shared_ptr<session::Db> sdb,
+                      std::shared_ptr<LeaderStubs> leader,
+                      bool observer = false)
+      : raft_(raft),
+        ds_(ds),
+        sdb_(sdb),
+        leader_(leader),
+        observer_(observer){};
 
  private:
+  using Stub = skinny::Skinny::Stub;
+
+  // Unless this server is the leader (or `local`, it can serve the call
+  // itself), the leader's reply to the call, or NOT_LEADER if the call cannot
+  // reach it. The forwarded call keeps the client's deadline.
+  template <typename Req, typename Res>
+  std::optional<Status> forward(
+      Status (Stub::*rpc)(grpc::ClientContext *, const Req &, Res *),
+      ServerContext *context, const Req *req, Res *res, bool local = false) {
+    if (local || raft_->is_leader()) return std::nullopt;
+    auto *stub = context->client_metadata().count(LeaderStubs::kForwardedKey)
+                     ? nullptr
+                     : leader_->stub();
+    if (!stub) {
+      return Status(
+          static_cast<grpc::StatusCode>(skinny::ErrorCode::NOT_LEADER),
+          std::to_string(raft_->get_leader()));
+    }
+    auto client_context = grpc::ClientContext::FromServerContext(*context);
+    client_context->AddMetadata(LeaderStubs::kForwardedKey, "1");
+    return (stub->*rpc)(client_context.get(), *req, res);
+  }
+
+  // How long an observer waits to catch up with a read's min_log_idx
+  static constexpr auto kObserverLagTimeout = std::chrono::milliseconds(500);
+
+  // OK if this server can serve a read at `min_log_idx`. An observer that is
+  // behind answers UNAVAILABLE, so the client reads from the leader instead.
+  Status check_readable(uint64_t min_log_idx) {
+    if (raft_->is_leader()) return Status::OK;
+    if (!observer_) {
+      return Status(
+          static_cast<grpc::StatusCode>(skinny::ErrorCode::NOT_LEADER),
+          std::to_string(raft_->get_leader()));
+    }
+    auto deadline = std::chrono::steady_clock::now() + kObserverLagTimeout;
+    if (!ds_->wait_applied(min_log_idx, deadline)) {
+      return OBSERVER_BEHIND_STATUS;
+    }
+    return Status::OK;
+  }
+
+  // The session, or an error. An observer may not have applied the session's
+  // latest opens yet.
+  Status find_reader(int64_t session_id, std::shared_ptr<session::Entry> &out,
+                     const std::vector<int> &fhs = {}) {
+    out = sdb_->find_session(session_id);
+    bool leader = raft_->is_leader();
+    if (!out) return leader ? SESSION_NOT_FOUND_STATUS : OBSERVER_BEHIND_STATUS;
+    for (int fh : fhs) {
+      if (out->handle_inum(fh) != -1) continue;
+      return leader ? INVALID_HANDLE_STATUS : OBSERVER_BEHIND_STATUS;
+    }
+    return Status::OK;
+  }
+
   Status parse_raft_result(
       nuraft::ptr<nuraft::cmd_result<nuraft::ptr<nuraft::buffer>>> r) {
     if (r->get_accepted() && r->get_result_code() == nuraft::OK) {
@@ -57,82 +311,147 @@ class SkinnyImpl final : public skinny::Skinny::Service {
 
   Status Open(ServerContext *context, const skinny::OpenReq *req,
               skinny::Handle *res) override {
+    profile::Span span("Open");
+    if (auto fwd = forward(&Stub::Open, context, req, res)) {
+      return *fwd;
+    }
     action::OpenAction action{req};
-    auto raft_ret = raft_->append_entries({action.serialize()});
+    auto raft_ret = append(*raft_, action);
     if (auto status = parse_raft_result(raft_ret); !status.ok()) {
       return status;
     }
     action::OpenReturn r(*raft_ret->get());
     std::filesystem::path path = req->path();
-    std::string parent_path = path.parent_path();
-    auto &[parent_meta, parent_content] = ds_->at(parent_path);
-    notify_events(parent_meta);
+    notify_events(path.parent_path());
     res->set_fh(r.fh);
     return Status::OK;
   }
 
   Status Close(ServerContext *context, const skinny::CloseReq *req,
-               skinny::Empty *) override {
+               skinny::Empty *res) override {
+    profile::Span span("Close");
+    if (auto fwd = forward(&Stub::Close, context, req, res)) {
+      return *fwd;
+    }
     action::CloseAction action{req->session_id(), req->fh()};
-    auto raft_ret = raft_->append_entries({action.serialize()});
+    auto raft_ret = append(*raft_, action);
     if (auto status = parse_raft_result(raft_ret); !status.ok()) {
       return status;
     }
     action::CloseReturn r(*raft_ret->get());
     if (r.need_notify) {
-      auto &[meta, content] = ds_->at(r.parent_path);
-      notify_events(meta);
+      notify_events(r.deleted);
+      notify_events(std::filesystem::path(r.deleted).parent_path());
     }
     return Status::OK;
   }
 
   Status GetContent(ServerContext *context, const skinny::GetContentReq *req,
                     skinny::Content *res) override {
-    if (!raft_->is_leader()) {
+    profile::Span span("GetContent");
+    if (auto fwd = forward(&Stub::GetContent, context, req, res, observer_)) {
+      return *fwd;
+    }
+    if (auto status = check_readable(req->min_log_idx()); !status.ok()) {
+      return status;
+    }
+    std::shared_ptr<session::Entry> session;
+    std::shared_lock lk(ds_->apply_lock);
+    if (auto status = find_reader(req->session_id(), session, {req->fh()});
+        !status.ok()) {
+      return status;
+    }
+    auto &[meta, content] = ds_->at(session->fh_to_key(req->fh()));
+    res->set_content(content);
+    res->set_content_gen(meta.content_gen_num);
+    return Status::OK;
+  }
+
+  // Served without a log entry. With `watch`, the session gets one
+  // invalidation event (carrying the path) on the next change to it; watches
+  // live in the leader's memory, so only the leader takes them.
+  Status GetContentByPath(ServerContext *context,
+                          const skinny::GetContentByPathReq *req,
+                          skinny::Content *res) override {
+    profile::Span span("GetContentByPath");
+    if (auto fwd = forward(&Stub::GetContentByPath, context, req, res,
+                           observer_ && !req->watch())) {
+      return *fwd;
+    }
+    if (req->watch() && !raft_->is_leader()) {
       return Status(
           static_cast<grpc::StatusCode>(skinny::ErrorCode::NOT_LEADER),
           std::to_string(raft_->get_leader()));
     }
-    auto session = sdb_->find_session(req->session_id());
-    if (!session) return SESSION_NOT_FOUND_STATUS;
-    auto &[meta, content] = ds_->at(session->fh_to_key(req->fh()));
+    if (auto status = check_readable(req->min_log_idx()); !status.ok()) {
+      return status;
+    }
+    std::shared_ptr<session::Entry> session;
+    if (req->watch()) {
+      session = sdb_->find_session(req->session_id());
+      if (!session) return SESSION_NOT_FOUND_STATUS;
+    }
+    std::shared_lock lk(ds_->apply_lock);
+    auto it = ds_->find(req->path());
+    if (it == ds_->end() || !it->second.first.file_exists) {
+      return Status(grpc::StatusCode::NOT_FOUND, "File does not exist");
+    }
+    auto &[meta, content] = it->second;
     res->set_content(content);
+    res->set_content_gen(meta.content_gen_num);
+    if (session) {
+      std::lock_guard lg(meta.watchers_mutex);
+      meta.path_watchers.insert(session->id);
+    }
     return Status::OK;
   }
 
   Status SetContent(ServerContext *context, const skinny::SetContentReq *req,
-                    skinny::Empty *) override {
+                    skinny::Empty *res) override {
+    profile::Span span("SetContent");
+    if (auto fwd = forward(&Stub::SetContent, context, req, res)) {
+      return *fwd;
+    }
+    ScopedTimer timer(stats::set_content);
     action::SetContentAction action{req};
-    auto raft_ret = raft_->append_entries({action.serialize()});
+    auto raft_ret = append(*raft_, action);
     if (auto status = parse_raft_result(raft_ret); !status.ok()) {
       return status;
     }
     auto session = sdb_->find_session(req->session_id());
     if (!session) return SESSION_NOT_FOUND_STATUS;
-    auto &[meta, content] = ds_->at(session->fh_to_key(req->fh()));
-    notify_events(meta);
+    if (!session->is_valid_handle(req->fh())) return INVALID_HANDLE_STATUS;
+    notify_events(session->fh_to_key(req->fh()));
     return Status::OK;
   }
 
-  Status StartSession(ServerContext *context, const skinny::Empty *,
+  Status StartSession(ServerContext *context, const skinny::Empty *req,
                       skinny::SessionId *res) override {
+    profile::Span span("StartSession");
+    if (auto fwd = forward(&Stub::StartSession, context, req, res)) {
+      return *fwd;
+    }
     action::StartSessionAction action;
-    auto raft_ret = raft_->append_entries({action.serialize()});
+    auto raft_ret = append(*raft_, action);
     if (auto status = parse_raft_result(raft_ret); !status.ok()) {
       return status;
     }
     action::StartSessionReturn r(*raft_ret->get());
     if (raft_->is_leader()) {
-      sdb_->find_session(r.session_id)->start_kathread();
+      sdb_->find_session(r.session_id)->start_lease();
     }
     res->set_session_id(r.session_id);
     return Status::OK;
   }
 
   Status EndSession(ServerContext *context, const skinny::SessionId *req,
-                    skinny::Empty *) override {
+                    skinny::Empty *res) override {
+    profile::Span span("EndSession");
+    if (auto fwd = forward(&Stub::EndSession, context, req, res)) {
+      return *fwd;
+    }
     action::EndSessionAction action(req->session_id());
-    auto raft_ret = raft_->append_entries({action.serialize()});
+    auto raft_ret = append(*raft_, action);
     if (auto status = parse_raft_result(raft_ret); !status.ok()) {
       return status;
     }
@@ -141,8 +460,9 @@ class SkinnyImpl final : public skinny::Skinny::Service {
     bs.get_str();
     int size = bs.get_i32();
     for (int i = 0; i < size; i++) {
-      auto &[meta, content] = ds_->at(bs.get_str());
-      notify_events(meta);
+      std::filesystem::path deleted = bs.get_str();
+      notify_events(deleted);
+      notify_events(deleted.parent_path());
     }
     return Status::OK;
   }
@@ -155,8 +475,13 @@ class SkinnyImpl final : public skinny::Skinny::Service {
   //  1: lock NOT acquired
   Status TryAcquire(ServerContext *context, const skinny::LockAcqReq *req,
                     skinny::Response *res) override {
+    profile::Span span("TryAcquire");
+    if (auto fwd = forward(&Stub::TryAcquire, context, req, res)) {
+      return *fwd;
+    }
     auto session = sdb_->find_session(req->session_id());
     if (!session) return SESSION_NOT_FOUND_STATUS;
+    if (!session->is_valid_handle(req->fh())) return INVALID_HANDLE_STATUS;
     auto key = session->fh_to_key(req->fh());
     auto &meta = ds_->at(key).first;
     std::lock_guard<std::mutex> guard(meta.mutex);
@@ -172,7 +497,7 @@ class SkinnyImpl final : public skinny::Skinny::Service {
     }
 
     action::AcqAction action(req->session_id(), req->fh(), req->ex());
-    auto raft_ret = raft_->append_entries({action.serialize()});
+    auto raft_ret = append(*raft_, action);
     if (auto status = parse_raft_result(raft_ret); !status.ok()) {
       return status;
     }
@@ -194,19 +519,26 @@ class SkinnyImpl final : public skinny::Skinny::Service {
   //  0: lock acquired
   Status Acquire(ServerContext *context, const skinny::LockAcqReq *req,
                  skinny::Response *res) override {
+    profile::Span span("Acquire");
+    if (auto fwd = forward(&Stub::Acquire, context, req, res)) {
+      return *fwd;
+    }
     auto session = sdb_->find_session(req->session_id());
     if (!session) return SESSION_NOT_FOUND_STATUS;
+    if (!session->is_valid_handle(req->fh())) return INVALID_HANDLE_STATUS;
     auto key = session->fh_to_key(req->fh());
     auto &meta = ds_->at(key).first;
 
     std::unique_lock<std::mutex> ulock(meta.mutex);
 
+    ds_->add_lock_waiters(key, 1);
     if (req->ex())
       meta.cv.wait(ulock, [&] { return meta.lock_owners.empty(); });
     else
       meta.cv.wait(ulock, [&] {
         return meta.lock_owners.empty() || !meta.is_locked_ex;
       });
+    ds_->add_lock_waiters(key, -1);
 
     if (session->handle_inum(req->fh()) != meta.instance_num) {
       res->set_res(-1);
@@ -220,7 +552,7 @@ class SkinnyImpl final : public skinny::Skinny::Service {
     }
 
     action::AcqAction action(req->session_id(), req->fh(), req->ex());
-    auto raft_ret = raft_->append_entries({action.serialize()});
+    auto raft_ret = append(*raft_, action);
     if (auto status = parse_raft_result(raft_ret); !status.ok()) {
       return status;
     }
@@ -234,12 +566,17 @@ class SkinnyImpl final : public skinny::Skinny::Service {
 
   Status Release(ServerContext *context, const skinny::LockRelReq *req,
                  skinny::Response *res) override {
+    profile::Span span("Release");
+    if (auto fwd = forward(&Stub::Release, context, req, res)) {
+      return *fwd;
+    }
     auto session = sdb_->find_session(req->session_id());
     if (!session) return SESSION_NOT_FOUND_STATUS;
+    if (!session->is_valid_handle(req->fh())) return INVALID_HANDLE_STATUS;
     auto &[meta, content] = ds_->at(session->fh_to_key(req->fh()));
     std::lock_guard lg(meta.mutex);
     action::RelAction action(req->session_id(), req->fh());
-    auto raft_ret = raft_->append_entries({action.serialize()});
+    auto raft_ret = append(*raft_, action);
     if (auto status = parse_raft_result(raft_ret); !status.ok()) {
       return status;
     }
@@ -253,8 +590,12 @@ class SkinnyImpl final : public skinny::Skinny::Service {
 
   Status Delete(ServerContext *context, const skinny::DeleteReq *req,
                 skinny::Response *res) override {
+    profile::Span span("Delete");
+    if (auto fwd = forward(&Stub::Delete, context, req, res)) {
+      return *fwd;
+    }
     action::DeleteAction action{req};
-    auto raft_ret = raft_->append_entries({action.serialize()});
+    auto raft_ret = append(*raft_, action);
     if (auto status = parse_raft_result(raft_ret); !status.ok()) {
       return status;
     }
@@ -263,55 +604,153 @@ class SkinnyImpl final : public skinny::Skinny::Service {
 
     auto session = sdb_->find_session(req->session_id());
     if (!session) return SESSION_NOT_FOUND_STATUS;
+    if (!session->is_valid_handle(req->fh())) return INVALID_HANDLE_STATUS;
     auto key = session->fh_to_key(req->fh());
     std::filesystem::path path{key};
-    std::string parent_path = path.parent_path();
-    auto &[parent_meta, parent_content] = ds_->at(parent_path);
-    notify_events(parent_meta);
+    notify_events(key);
+    notify_events(path.parent_path());
     return Status::OK;
   }
 
-  void notify_events(FileMetaData &meta) {
-    std::vector<std::thread> vt;
-    for (auto it = meta.subscribers.begin(); it != meta.subscribers.end();) {
-      auto session = sdb_->find_session(it->first);
-      if (session && session->handle_inum(it->second) != -1) {
-        auto eid = session->enqueue_event(it->second);
-        if (eid) {
-          vt.emplace_back([session, eid = eid.value()]() {
-            session->block_until_event_acked(eid);
-          });
-        }
-        it++;
-      } else {
-        it = meta.subscribers.erase(it);
-      }
+  Status Txn(ServerContext *context, const skinny::TxnReq *req,
+             skinny::TxnRes *res) override {
+    profile::Span span("Txn");
+    if (auto fwd = forward(&Stub::Txn, context, req, res)) {
+      return *fwd;
     }
-    for (auto &t : vt) {
-      t.join();
+    action::TxnReturn r;
+    if (auto status = commit_txn(action::TxnAction{req}, r); !status.ok()) {
+      return status;
     }
+    res->set_succeeded(r.res == 0);
+    res->set_failed_guard(r.failed_guard);
+    for (auto fh : r.fhs) res->add_fhs(fh);
+    return Status::OK;
+  }
+
+  // All paths are opened in one Raft entry; none is if any parent is missing.
+  Status OpenMany(ServerContext *context, const skinny::OpenManyReq *req,
+                  skinny::Handles *res) override {
+    profile::Span span("OpenMany");
+    if (auto fwd = forward(&Stub::OpenMany, context, req, res)) {
+      return *fwd;
+    }
+    action::TxnAction action;
+    action.session_id = req->session_id();
+    for (auto &path : req->paths()) {
+      action.ops.emplace_back(skinny::TxnOp::OPEN, -1, path, "",
+                              req->is_directory(), req->is_ephemeral());
+    }
+    action::TxnReturn r;
+    if (auto status = commit_txn(action, r); !status.ok()) {
+      return status;
+    }
+    for (auto fh : r.fhs) res->add_fhs(fh);
+    return Status::OK;
+  }
+
+  // All contents are read from the same state, between two log entries.
+  Status GetContentMany(ServerContext *context,
+                        const skinny::GetContentManyReq *req,
+                        skinny::Contents *res) override {
+    profile::Span span("GetContentMany");
+    if (auto fwd =
+            forward(&Stub::GetContentMany, context, req, res, observer_)) {
+      return *fwd;
+    }
+    if (auto status = check_readable(req->min_log_idx()); !status.ok()) {
+      return status;
+    }
+    std::shared_ptr<session::Entry> session;
+    std::shared_lock lk(ds_->apply_lock);
+    if (auto status = find_reader(
+            req->session_id(), session,
+            std::vector<int>(req->fhs().begin(), req->fhs().end()));
+        !status.ok()) {
+      return status;
+    }
+    for (auto fh : req->fhs()) {
+      auto &[meta, content] = ds_->at(session->fh_to_key(fh));
+      auto *c = res->add_contents();
+      c->set_content(content);
+      c->set_content_gen(meta.content_gen_num);
+    }
+    return Status::OK;
+  }
+
+  Status CloseMany(ServerContext *context, const skinny::CloseManyReq *req,
+                   skinny::Empty *res) override {
+    profile::Span span("CloseMany");
+    if (auto fwd = forward(&Stub::CloseMany, context, req, res)) {
+      return *fwd;
+    }
+    action::TxnAction action;
+    action.session_id = req->session_id();
+    for (auto fh : req->fhs()) {
+      action.ops.emplace_back(skinny::TxnOp::CLOSE, fh, "", "", 0, 0);
+    }
+    action::TxnReturn r;
+    return commit_txn(action, r);
+  }
+
+  // Appends a TxnAction and notifies the subscribers of every touched path.
+  Status commit_txn(const action::TxnAction &action, action::TxnReturn &r) {
+    auto raft_ret = append(*raft_, action, action.ops.size());
+    if (auto status = parse_raft_result(raft_ret); !status.ok()) {
+      return status;
+    }
+    r = action::TxnReturn(*raft_ret->get());
+    std::unordered_set<std::string> notified;
+    for (auto &path : r.notify_paths) {
+      if (notified.insert(path).second) notify_events(path);
+    }
+    return Status::OK;
+  }
+
+  // Called after the change to `key` committed, so the commit index covers it
+  void notify_events(const std::string &key) {
+    ::notify_events(*ds_, *sdb_, key, raft_->get_committed_log_idx());
   }
 
   std::shared_ptr<nuraft::raft_server> raft_;
   const std::shared_ptr<DataStore> ds_;
   std::shared_ptr<session::Db> sdb_;
+  std::shared_ptr<LeaderStubs> leader_;
+  const bool observer_;
 };
 
 class SkinnyCbImpl final : public skinny::SkinnyCb::CallbackService {
  public:
   explicit SkinnyCbImpl(std::shared_ptr<nuraft::raft_server> raft,
-                        std::shared_ptr<session::Db> sdb)
-      : sdb_(sdb), raft_(raft){};
+                        std::shared_ptr<session::Db> sdb,
+                        std::shared_ptr<LeaderStubs> leader)
+      : sdb_(sdb), raft_(raft), leader_(leader){};
 
  private:
   ServerUnaryReactor *KeepAlive(grpc::CallbackServerContext *context,
                                 const skinny::KeepAliveReq *req,
                                 skinny::Event *res) override {
+    profile::Span span("KeepAlive");
     ServerUnaryReactor *reactor = context->DefaultReactor();
     if (!raft_->is_leader()) {
-      reactor->Finish(
-          Status(static_cast<grpc::StatusCode>(skinny::ErrorCode::NOT_LEADER),
-                 std::to_string(raft_->get_leader())));
+      // Forwarded like the other calls, and finished when the leader replies
+      auto *stub = context->client_metadata().count(LeaderStubs::kForwardedKey)
+                       ? nullptr
+                       : leader_->stub_cb();
+      if (!stub) {
+        reactor->Finish(Status(
+            static_cast<grpc::StatusCode>(skinny::ErrorCode::NOT_LEADER),
+            std::to_string(raft_->get_leader())));
+        return reactor;
+      }
+      auto *client_context =
+          grpc::ClientContext::FromCallbackServerContext(*context).release();
+      client_context->AddMetadata(LeaderStubs::kForwardedKey, "1");
+      stub->async()->KeepAlive(client_context, req, res,
+                               [reactor, client_context](Status status) {
+                                 delete client_context;
+                                 reactor->Finish(status);
+                               });
       return reactor;
     }
     auto session = sdb_->find_session(req->session_id());
@@ -320,11 +759,18 @@ class SkinnyCbImpl final : public skinny::SkinnyCb::CallbackService {
       return reactor;
     }
     // std::cout << "keepalive" << std::endl;
+    auto term = raft_->get_term();
+    res->set_log_idx(raft_->get_committed_log_idx());
+    res->set_term(term);
+    // A client that has not seen this term yet may hold cache entries that
+    // no watch here covers; it hears of the term without waiting
     session->set_reactor(reactor, res,
-                         req->has_acked_event() ? req->acked_event() : -1);
+                         req->has_acked_event() ? req->acked_event() : -1,
+                         req->term() != term);
     return reactor;
   }
 
   std::shared_ptr<nuraft::raft_server> raft_;
   std::shared_ptr<session::Db> sdb_;
+  std::shared_ptr<LeaderStubs> leader_;
 };
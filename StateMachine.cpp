@@ -1,13 +1,16 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
 #include <exception>
 #include <filesystem>
 #include <iostream>
 #include <mutex>
+#include <unordered_set>
 #include <variant>
 
 #include "Session.cpp"
@@ -16,6 +19,8 @@
 #include "libnuraft/buffer.hxx"
 #include "libnuraft/nuraft.hxx"
 #include "libnuraft/state_machine.hxx"
+#include "profile.h"
+#include "stats.h"
 #include "utils.h"
 
 namespace StateMachine {
@@ -28,11 +33,19 @@ class StateMachine : public state_machine {
   ~StateMachine() {}
 
   ptr<buffer> commit(const ulong log_idx, buffer& data) override {
+    profile::Span span("commit");
+    auto queued = std::chrono::steady_clock::now();
+    std::unique_lock lk(ds_->apply_lock);
+    stats::queue_wait.record(std::chrono::steady_clock::now() - queued);
+    ScopedTimer timer(stats::apply);
+    applying_idx_ = log_idx;
     auto action = action::create_action_from_buf(data);
     auto result =
         std::visit([this](auto&& arg) { return apply_(arg); }, action);
     // Update last committed index number.
     last_committed_idx_ = log_idx;
+    lk.unlock();
+    ds_->set_applied(log_idx);
     return result;
   }
 
@@ -53,36 +66,43 @@ class StateMachine : public state_machine {
     if (!session) {
       return action::OpenReturn(-1, SESSION_NOT_FOUND_STR, -1).serialize();
     }
-    if (ds_->find(a.path) == ds_->end()) {
-      ds_->operator[](a.path);
+    std::filesystem::path path = a.path;
+    auto parent = ds_->find(path.parent_path());
+    if (!path.is_absolute() || parent == ds_->end() ||
+        !parent->second.first.file_exists ||
+        !parent->second.first.is_directory) {
+      return action::OpenReturn(-1, "Parent is not a directory", -1)
+          .serialize();
+    }
+    auto fh = open_file(*session, a.path, a.is_directory, a.is_ephemeral);
+    action::OpenReturn ret(0, "OK", fh);
+    return ret.serialize();
+  }
+
+  // Caller must have checked that the parent directory exists.
+  int open_file(session::Entry& session, const std::string& key,
+                bool is_directory, bool is_ephemeral) {
+    if (ds_->find(key) == ds_->end()) {
+      ds_->operator[](key);
     }
-    auto& [meta, content] = ds_->at(a.path);
+    auto& [meta, content] = ds_->at(key);
     // Handle creating a directory
     if (meta.file_exists == false) {
-      meta.is_directory = a.is_directory;
+      meta.is_directory = is_directory;
     }
-    meta.is_ephemeral = a.is_ephemeral;
+    meta.is_ephemeral = is_ephemeral;
     // Update parent dir
-    std::filesystem::path path = a.path;
+    std::filesystem::path path = key;
     std::string parent_path = path.parent_path();
-    if (!ds_->contains(parent_path)) {
-      std::cout << "Parent path does not exist" << std::endl;
-      assert(0);
-    }
     auto& [parent_meta, parent_content] = ds_->at(parent_path);
-    if (!parent_meta.is_directory) {
-      std::cout << "Parent is not a directory" << std::endl;
-      assert(0);
-    }
     if (path != "/" && meta.file_exists == false) {
       std::lock_guard lg(parent_meta.mutex);
       parent_content += std::string(1, '\0') + std::string(path.filename());
     }
     meta.file_exists = true;  // for previously deleted keys
-    auto fh = session->add_new_handle(a.path, meta.instance_num);
-    meta.subscribers[session->id] = fh;
-    action::OpenReturn ret(0, "OK", fh);
-    return ret.serialize();
+    auto fh = session.add_new_handle(key, meta.instance_num);
+    meta.subscribers[session.id] = fh;
+    return fh;
   }
 
   ptr<buffer> apply_(action::CloseAction& a) {
@@ -93,9 +113,12 @@ class StateMachine : public state_machine {
     }
     auto ret = close_file_delete_ephermeral(*session, a.fh);
     release_lock(a.session_id, a.fh);
-    return action::CloseReturn(0, "OK", !!ret, ret.value()).serialize();
+    return action::CloseReturn(0, "OK", !!ret, ret.value_or(""))
+        .serialize();
   }
 
+  // The ephemeral file that closing `fh` deleted, if any. Its watchers and
+  // its parent's are to be notified.
   std::optional<std::string> close_file_delete_ephermeral(
       session::Entry& session, int fh) {
     if (session.handle_inum(fh) == -1) return std::nullopt;
@@ -103,23 +126,17 @@ class StateMachine : public state_machine {
     std::string key = session.fh_to_key(fh);
     auto& [meta, content] = ds_->at(key);
 
-    if (meta.subscribers.contains(session.id)) {
-      meta.subscribers.erase(session.id);
-      if (meta.subscribers.empty() && meta.is_ephemeral) {
-        meta.file_exists = false;
-        std::filesystem::path path{key};
-        std::filesystem::path parent_path = path.parent_path();
-        auto& [parent_meta, parent_content] = ds_->at(parent_path);
-        {
-          std::lock_guard lg(parent_meta.mutex);
-          size_t pos = parent_content.find(std::string(1, '\0') +
-                                           std::string(path.filename()));
-          if (pos != std::string::npos) {
-            parent_content.erase(pos,
-                                 std::string(path.filename()).length() + 1);
-            return parent_path;
-          }
-        }
+    if (auto it = meta.subscribers.find(session.id);
+        it != meta.subscribers.end() && it->second == fh) {
+      // Keep the session subscribed through its other handles to the file
+      if (auto other = session.find_open_handle(key)) {
+        it->second = other.value();
+        return std::nullopt;
+      }
+      meta.subscribers.erase(it);
+      if (meta.subscribers.empty() && meta.is_ephemeral && meta.file_exists) {
+        delete_file(key, -1);
+        return key;
       }
     }
     return std::nullopt;
@@ -136,41 +153,70 @@ class StateMachine : public state_machine {
     if (!session) {
       return action::Response(-1, SESSION_NOT_FOUND_STR).serialize();
     }
-    std::vector<std::string> parent_path;
+    std::vector<std::string> deleted;
     const std::string ok = "OK";
     int size =
         sizeof(int32_t) + sizeof(ok.size()) + ok.size() + sizeof(int32_t);
-    for (int i = 0; i < session->handle_count(); ++i) {
-      auto ret = close_file_delete_ephermeral(*session, i);
-      if (ret) {
-        parent_path.push_back(ret.value());
-        size += parent_path.size() + sizeof(parent_path.size());
-      }
-      release_lock(a.session_id, i);
-    }
-    sdb_->delete_session(a.session_id);
+    end_session(*session, [&](std::string path) {
+      size += path.size() + sizeof(path.size());
+      deleted.push_back(std::move(path));
+    });
     nuraft::ptr<nuraft::buffer> buf = nuraft::buffer::alloc(size);
     nuraft::buffer_serializer bs(buf);
     bs.put_i32(0);
     bs.put_str(ok);
-    bs.put_i32(parent_path.size());
-    for (auto& s : parent_path) {
+    bs.put_i32(deleted.size());
+    for (auto& s : deleted) {
       bs.put_str(s);
     }
     return buf;
   }
 
+  // Sessions already gone are skipped
+  ptr<buffer> apply_(action::EndSessionsAction& a) {
+    action::EndSessionsReturn r(0, "OK", 0, {});
+    std::unordered_set<std::string> notified;
+    for (auto session_id : a.session_ids) {
+      auto session = sdb_->find_session(session_id);
+      if (!session) continue;
+      end_session(*session, [&](std::string path) {
+        std::string parent = std::filesystem::path(path).parent_path();
+        if (notified.insert(path).second) r.notify_paths.push_back(path);
+        if (notified.insert(parent).second) r.notify_paths.push_back(parent);
+      });
+      ++r.ended;
+    }
+    return r.serialize();
+  }
+
+  // Closes every handle of the session, releasing its locks and deleting its
+  // ephemeral files, and deletes it. `on_delete` gets each deleted file.
+  template <typename F>
+  void end_session(session::Entry& session, F&& on_delete) {
+    int session_id = session.id;
+    for (int fh : session.open_handles()) {
+      if (auto deleted = close_file_delete_ephermeral(session, fh)) {
+        on_delete(std::move(*deleted));
+      }
+      release_lock(session_id, fh);
+    }
+    sdb_->delete_session(session_id);
+  }
+
   ptr<buffer> apply_(action::SetContentAction& a) {
     auto session = sdb_->find_session(a.session_id);
     if (!session) {
       return action::Response(-1, SESSION_NOT_FOUND_STR).serialize();
     }
+    if (!session->is_valid_handle(a.fh))
+      return action::Response(-1, INVALID_HANDLE_STR).serialize();
     auto& [meta, content] = ds_->at(session->fh_to_key(a.fh));
     if (session->handle_inum(a.fh) != meta.instance_num)
       return action::Response(-1, "Instance num mismatch").serialize();
     if (!meta.file_exists)
       return action::Response(-1, "File does not exist").serialize();
     content = a.content;
+    meta.content_gen_num++;
     return action::Response(0, "OK").serialize();
   }
 
@@ -181,6 +227,8 @@ class StateMachine : public state_machine {
     if (!session) {
       return action::Response(-1, SESSION_NOT_FOUND_STR).serialize();
     }
+    if (!session->is_valid_handle(a.fh))
+      return action::Response(-1, INVALID_HANDLE_STR).serialize();
     auto key = session->fh_to_key(a.fh);
     auto& meta = ds_->at(key).first;
 
@@ -227,11 +275,11 @@ class StateMachine : public state_machine {
 
   // return: whether a lock is released.
   // -2: file not found
-  // -1: the session does not hold this lock
+  // -1: the session does not hold this lock, or fh is invalid
   // 0: release succeed
   int release_lock(int session_id, int fh) {
     auto session = sdb_->find_session(session_id);
-    if (session == nullptr) return -1;
+    if (session == nullptr || !session->is_valid_handle(fh)) return -1;
     auto& [meta, content] = ds_->at(session->fh_to_key(fh));
     bool released;
 
@@ -252,23 +300,32 @@ class StateMachine : public state_machine {
     if (session == nullptr) {
       return action::Response({-1, SESSION_NOT_FOUND_STR}).serialize();
     }
+    if (!session->is_valid_handle(a.fh))
+      return action::Response(-1, INVALID_HANDLE_STR).serialize();
     auto key = session->fh_to_key(a.fh);
     auto& [meta, content] = ds_->at(key);
-    if (meta.is_directory && !content.empty()) {
-      std::cout << "Directory is not empty" << std::endl;
-      assert(0);
-    }
+    if (meta.is_directory && !content.empty())
+      return action::Response(-1, "Directory is not empty").serialize();
+    delete_file(key, a.fh);
+    action::Response res({0, ""});
+    return res.serialize();
+  }
+
+  // Lock owners are notified with `fh` when it is a valid handle.
+  void delete_file(const std::string& key, int fh) {
+    auto& [meta, content] = ds_->at(key);
     content.clear();
     {
       std::lock_guard<std::mutex> guard(meta.mutex);
       meta.file_exists = false;
       meta.instance_num++;
-      meta.content_gen_num = 0;
+      // Not reset, so that a generation names one content across instances
+      meta.content_gen_num++;
       meta.lock_gen_num = 0;
       for (const int& session_id : meta.lock_owners) {
-        session = sdb_->find_session(session_id);
-        if (session) {
-          session->enqueue_event(a.fh);
+        auto session = sdb_->find_session(session_id);
+        if (session && fh >= 0) {
+          session->enqueue_event(fh, applying_idx_);
         }
       }
       meta.lock_owners.clear();
@@ -284,12 +341,199 @@ class StateMachine : public state_machine {
       if (pos != std::string::npos)
         parent_content.erase(pos, std::string(path.filename()).length() + 1);
     }
-    action::Response res({0, ""});
-    return res.serialize();
+  }
+
+  // All guards are checked against the state before the transaction, and
+  // each op is validated against the state the ops before it leave; only
+  // then are the ops applied, in order.
+  // TxnReturn.res:
+  // -1: session not found or an op is invalid, nothing applied
+  //  0: all guards held and all ops applied
+  //  1: guard `failed_guard` did not hold, nothing applied
+  ptr<buffer> apply_(action::TxnAction& a) {
+    auto session = sdb_->find_session(a.session_id);
+    if (!session) {
+      return action::TxnReturn(-1, SESSION_NOT_FOUND_STR, -1, {}, {})
+          .serialize();
+    }
+    for (int i = 0; i < a.guards.size(); ++i) {
+      if (!check_guard(*session, a.guards[i])) {
+        return action::TxnReturn(1, "Guard failed", i, {}, {}).serialize();
+      }
+    }
+    TxnView view;
+    for (auto& op : a.ops) {
+      if (auto err = validate_op(*session, op, view); err) {
+        return action::TxnReturn(-1, err.value(), -1, {}, {}).serialize();
+      }
+    }
+    action::TxnReturn ret(0, "OK", -1, {}, {});
+    for (auto& op : a.ops) {
+      // Closing an already closed handle is a no-op
+      auto target = txn_target(*session, op.fh, op.path);
+      if (!target) continue;
+      auto& key = target.value();
+      std::string parent_path = std::filesystem::path(key).parent_path();
+      switch (op.type) {
+        case skinny::TxnOp::SET_CONTENT: {
+          auto& [meta, content] = ds_->at(key);
+          content = op.content;
+          meta.content_gen_num++;
+          ret.notify_paths.push_back(key);
+          break;
+        }
+        case skinny::TxnOp::OPEN:
+          ret.fhs.push_back(
+              open_file(*session, key, op.is_directory, op.is_ephemeral));
+          ret.notify_paths.push_back(parent_path);
+          break;
+        case skinny::TxnOp::DELETE:
+          delete_file(key, op.path.empty() ? op.fh : -1);
+          ret.notify_paths.push_back(key);
+          ret.notify_paths.push_back(parent_path);
+          break;
+        case skinny::TxnOp::CLOSE:
+          if (auto deleted = close_file_delete_ephermeral(*session, op.fh)) {
+            ret.notify_paths.push_back(*deleted);
+            ret.notify_paths.push_back(
+                std::filesystem::path(*deleted).parent_path());
+          }
+          release_lock(session->id, op.fh);
+          break;
+      }
+    }
+    return ret.serialize();
+  }
+
+  std::optional<std::string> txn_target(session::Entry& session, int fh,
+                                        const std::string& path) {
+    if (!path.empty()) return path;
+    if (session.handle_inum(fh) == -1) return std::nullopt;
+    return session.fh_to_key(fh);
+  }
+
+  // A guard naming a handle holds only while the handle's instance of the
+  // file is the current one.
+  bool check_guard(session::Entry& session, const action::TxnGuard& g) {
+    auto key = txn_target(session, g.fh, g.path);
+    auto it = key ? ds_->find(key.value()) : ds_->end();
+    bool exists = it != ds_->end() && it->second.first.file_exists &&
+                  (!g.path.empty() ||
+                   session.handle_inum(g.fh) == it->second.first.instance_num);
+    switch (g.type) {
+      case skinny::TxnGuard::EXISTS:
+        return exists;
+      case skinny::TxnGuard::NOT_EXISTS:
+        return key && !exists;
+      case skinny::TxnGuard::CONTENT_GEN_EQ:
+        return exists && it->second.first.content_gen_num == g.value;
+      case skinny::TxnGuard::NOT_LOCKED:
+        return key && (!exists || it->second.first.lock_owners.empty());
+      case skinny::TxnGuard::LOCKED_BY_ME:
+        return exists && it->second.first.lock_owners.contains(session.id);
+      default:
+        return false;
+    }
+  }
+
+  // What the ops of a transaction validated so far change, over ds_
+  struct TxnView {
+    std::unordered_map<std::string, bool> exists;
+    std::unordered_map<std::string, bool> is_directory;
+    std::unordered_map<std::string, int> instance_num;
+    std::unordered_map<std::string, int> children;  // of directories
+    std::unordered_set<int> closed;
+  };
+
+  // Validates `op` against `view` and records its changes there.
+  // return: error message if the op cannot be applied
+  std::optional<std::string> validate_op(session::Entry& session,
+                                         const action::TxnOp& op,
+                                         TxnView& view) {
+    auto meta_of = [&](const std::string& key) -> const FileMetaData* {
+      auto it = ds_->find(key);
+      return it == ds_->end() ? nullptr : &it->second.first;
+    };
+    auto exists = [&](const std::string& key) {
+      if (auto it = view.exists.find(key); it != view.exists.end())
+        return it->second;
+      auto meta = meta_of(key);
+      return meta && meta->file_exists;
+    };
+    auto is_directory = [&](const std::string& key) {
+      if (auto it = view.is_directory.find(key); it != view.is_directory.end())
+        return it->second;
+      return meta_of(key)->is_directory;
+    };
+    auto instance_num = [&](const std::string& key) {
+      if (auto it = view.instance_num.find(key); it != view.instance_num.end())
+        return it->second;
+      auto meta = meta_of(key);
+      return meta ? meta->instance_num : 0;
+    };
+    auto children = [&](const std::string& key) -> int& {
+      auto [it, inserted] = view.children.try_emplace(key, 0);
+      if (inserted && meta_of(key) && meta_of(key)->file_exists) {
+        auto& content = ds_->at(key).second;
+        it->second = std::count(content.begin(), content.end(), '\0');
+      }
+      return it->second;
+    };
+
+    if (op.type == skinny::TxnOp::CLOSE) {
+      // Closing an already closed handle is a no-op, like CloseAction
+      if (!op.path.empty() || !session.is_valid_handle(op.fh))
+        return INVALID_HANDLE_STR;
+      if (session.handle_inum(op.fh) != -1 &&
+          view.closed.insert(op.fh).second) {
+        // Closing may delete an ephemeral file; later ops must not count on
+        // it either way. Its parent keeps its child, so that the parent
+        // cannot be deleted in this transaction.
+        auto& key = session.fh_to_key(op.fh);
+        if (auto meta = meta_of(key); meta && meta->is_ephemeral)
+          view.exists[key] = false;
+      }
+      return std::nullopt;
+    }
+    if (op.path.empty() && view.closed.contains(op.fh))
+      return INVALID_HANDLE_STR;
+    auto key = txn_target(session, op.fh, op.path);
+    if (!key) return INVALID_HANDLE_STR;
+    std::filesystem::path path = key.value();
+    if (op.type == skinny::TxnOp::OPEN) {
+      std::string parent = path.parent_path();
+      if (!path.is_absolute() || !exists(parent) || !is_directory(parent))
+        return "Parent is not a directory";
+      if (!exists(key.value())) {
+        view.exists[key.value()] = true;
+        view.is_directory[key.value()] = op.is_directory;
+        if (path != "/") ++children(parent);
+      }
+      return std::nullopt;
+    }
+    if (!exists(key.value())) return "File does not exist";
+    if (op.path.empty() &&
+        session.handle_inum(op.fh) != instance_num(key.value()))
+      return "Instance num mismatch";
+    switch (op.type) {
+      case skinny::TxnOp::SET_CONTENT:
+        return std::nullopt;
+      case skinny::TxnOp::DELETE:
+        if (key.value() == "/") return "Cannot delete root";
+        if (is_directory(key.value()) && children(key.value()) > 0)
+          return "Directory is not empty";
+        view.exists[key.value()] = false;
+        view.instance_num[key.value()] = instance_num(key.value()) + 1;
+        --children(path.parent_path());
+        return std::nullopt;
+      default:
+        return "Unknown op";
+    }
   }
 
   // Last committed Raft log number.
   std::atomic<uint64_t> last_committed_idx_;
+  uint64_t applying_idx_ = 0;  // of the entry being applied
 
   std::shared_ptr<session::Db> sdb_;
   std::shared_ptr<DataStore> ds_;
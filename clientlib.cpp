@@ -1,13 +1,16 @@
 #include "clientlib.h"
 
 #include <fcntl.h>
+#include <grpcpp/alarm.h>
 #include <grpcpp/client_context.h>
+#include <grpcpp/completion_queue.h>
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/support/status.h>
 #include <grpcpp/support/status_code_enum.h>
 #include <signal.h>
 #include <sys/stat.h>
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <condition_variable>
@@ -18,10 +21,17 @@
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <random>
 #include <string>
 #include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 
+#include "clientlib_cache.h"
 #include "clientlib_diagnostic.h"
+#include "clientlib_executor.h"
+#include "clientlib_trace.h"
 #include "grpcpp/channel.h"
 #include "grpcpp/create_channel.h"
 #include "grpcpp/security/credentials.h"
@@ -32,10 +42,51 @@
 #include "utils.h"
 using grpc::ClientContext;
 
+// Recent latencies of one kind of call
+class LatencyWindow {
+ public:
+  void add(std::chrono::steady_clock::duration d) {
+    std::lock_guard lg(mutex_);
+    if (samples_.size() < kSamples) {
+      samples_.push_back(d);
+    } else {
+      samples_[next_++ % kSamples] = d;
+    }
+  }
+  // Until there are enough samples, returns kDefault
+  std::chrono::steady_clock::duration p95() {
+    std::vector<std::chrono::steady_clock::duration> sorted;
+    {
+      std::lock_guard lg(mutex_);
+      if (samples_.size() < kMinSamples) return kDefault;
+      sorted = samples_;
+    }
+    auto nth = sorted.begin() + sorted.size() * 95 / 100;
+    std::nth_element(sorted.begin(), nth, sorted.end());
+    return *nth;
+  }
+
+ private:
+  static constexpr int kSamples = 256;
+  static constexpr int kMinSamples = 20;
+  static constexpr auto kDefault = std::chrono::milliseconds(50);
+  std::mutex mutex_;
+  std::vector<std::chrono::steady_clock::duration> samples_;
+  int next_ = 0;
+};
+
 class SkinnyClient::impl {
  public:
-  impl()
-      : kathread(std::invoke(([this]() {
+  impl(const SkinnyClientOptions &options)
+      : call_timeout_(options.call_timeout),
+        hedge_reads_(options.hedge_reads),
+        members_(ConnectAll()),
+        observer_(PickObserver(options)),
+        preferred_(member_of(options.preferred_server)),
+        cache_(options.cache_bytes, options.cache_shards),
+        callback_executor_(std::in_place, options.callback_threads,
+                           options.max_queued_callbacks),
+        kathread(std::invoke(([this]() {
           StartSessionOrDie();
           return [this]() {
             std::optional<int> eid = std::nullopt;
@@ -43,19 +94,127 @@ class SkinnyClient::impl {
               eid = KeepAlive(eid);
             }
           };
-        }))) {}
+        }))),
+        cq_thread_([this]() {
+          void *tag;
+          bool ok;
+          while (cq_.Next(&tag, &ok)) {
+            static_cast<AsyncCallBase *>(tag)->Proceed();
+          }
+        }) {
+    const char *env_trace = std::getenv("SKINNY_TRACE");
+    auto trace_path = options.trace_path.empty() && env_trace
+                          ? std::string(env_trace)
+                          : options.trace_path;
+    if (!trace_path.empty()) {
+      trace_ = TraceWriter::open(trace_path);
+      trace_client_ = trace_->new_client();
+      trace_->write({.time_us = trace_->now_us(),
+                     .op = TraceOp::START,
+                     .client = trace_client_});
+    }
+  }
+
+  // The process-wide connection, created by the first caller with its options
+  static std::shared_ptr<impl> shared(const SkinnyClientOptions &options) {
+    static std::mutex mutex;
+    static std::weak_ptr<impl> instance;
+    std::lock_guard lg(mutex);
+    auto conn = instance.lock();
+    if (!conn) {
+      conn = std::make_shared<impl>(options);
+      instance = conn;
+    }
+    return conn;
+  }
 
   ~impl() {
+    if (trace_) {
+      trace_->write({.time_us = trace_->now_us(),
+                     .op = TraceOp::END,
+                     .client = trace_client_});
+    }
     if (has_conn_.load()) {
       ClientContext context;
       skinny::SessionId req;
       skinny::Empty res;
       req.set_session_id(session_id);
-      stub_->EndSession(&context, req, &res);
+      if (auto deadline = Deadline()) context.set_deadline(*deadline);
+      stub()->EndSession(&context, req, &res);
     }
     cancelled_.store(true);
     cv_.notify_one();
     kathread.join();
+    // Callbacks already queued run while the rest of the client is alive
+    callback_executor_.reset();
+    {
+      std::lock_guard lg(async_lock_);
+      cq_shutdown_ = true;
+      for (auto *context : async_contexts_) context->TryCancel();
+      cq_.Shutdown();
+    }
+    cq_thread_.join();
+  }
+
+  // Runs a call of the public API and, if this client traces, records it as
+  // `record` with the time it was made. `on_result` adds what it returned.
+  template <typename Call, typename OnResult = std::nullptr_t>
+  auto Traced(TraceRecord record, Call &&call, OnResult on_result = nullptr) {
+    if (!trace_) return call();
+    record.time_us = trace_->now_us();
+    record.client = trace_client_;
+    // Written on the way out, by a throw too
+    struct Writer {
+      ~Writer() {
+        if (std::uncaught_exceptions() > exceptions) {
+          record.flags |= TraceRecord::FAILED;
+        }
+        trace.write(record);
+      }
+      TraceWriter &trace;
+      TraceRecord &record;
+      int exceptions = std::uncaught_exceptions();
+    } writer{*trace_, record};
+    if constexpr (std::is_void_v<decltype(call())>) {
+      call();
+    } else {
+      auto result = call();
+      if constexpr (!std::is_null_pointer_v<OnResult>) {
+        on_result(record, result);
+      }
+      return result;
+    }
+  }
+
+  // Wraps the callback of an asynchronous call so that the call is recorded
+  // when it completes, with the time it was made.
+  template <typename T>
+  AsyncCallback<T> TracedAsync(TraceRecord record, AsyncCallback<T> done) {
+    if (!trace_) return done;
+    record.time_us = trace_->now_us();
+    record.client = trace_client_;
+    record.flags |= TraceRecord::ASYNC;
+    return [trace = trace_, record = std::move(record),
+            done = std::move(done)](std::future<T> result) mutable {
+      // The result is taken out of the future to record it, and handed on in
+      // a new one
+      std::promise<T> next;
+      try {
+        if constexpr (std::is_void_v<T>) {
+          result.get();
+          next.set_value();
+        } else {
+          auto value = result.get();
+          if constexpr (std::is_same_v<T, int>) record.results.push_back(value);
+          next.set_value(std::move(value));
+        }
+      } catch (...) {
+        record.flags |= TraceRecord::FAILED;
+        next.set_exception(std::current_exception());
+      }
+      trace->write(record);
+      done(next.get_future());
+    };
   }
 
   int Open(const std::string &path,
@@ -67,15 +226,12 @@ class SkinnyClient::impl {
     req.set_session_id(session_id);
     req.set_is_directory(is_directory);
     req.set_is_ephemeral(is_ephemeral);
-    auto status = InvokeRpc([&]() {
-      ClientContext context;
-      return stub_->Open(&context, req, &res);
+    auto status = InvokeRpc([&](ClientContext &context) {
+      return stub()->Open(&context, req, &res);
     });
-    assert(status.ok());
+    check(status);
     auto fh = res.fh();
-    if (cb) {
-      callbacks[fh] = cb.value();
-    }
+    add_handle(fh, path, cb);
     return fh;
   }
 
@@ -84,40 +240,129 @@ class SkinnyClient::impl {
     skinny::Empty res;
     req.set_session_id(session_id);
     req.set_fh(fh);
-    auto status = InvokeRpc([&]() {
-      ClientContext context;
-      return stub_->Close(&context, req, &res);
+    auto status = InvokeRpc([&](ClientContext &context) {
+      return stub()->Close(&context, req, &res);
     });
-    {
-      std::lock_guard lg(cache_lock_);
-      if (auto it = cache_.find(fh); it != cache_.end()) {
-        cache_.erase(it);
-      }
-    }
+    remove_handle(fh);
   }
 
-  std::string GetContent(int fh) {
-    {
-      std::lock_guard lg(cache_lock_);
-      if (auto it = cache_.find(fh);
-          has_conn_.load() == true && it != cache_.end()) {
-        return it->second;
+  std::string GetContent(int fh, int *content_gen = nullptr) {
+    auto path = path_of(fh);
+    if (path && has_conn_.load() == true) {
+      if (auto cached = cache_.get(path.value())) {
+        if (content_gen) *content_gen = cached->content_gen;
+        return cached->content;
       }
     }
+    int invalidations = invalidations_.load();
     skinny::GetContentReq req;
-    ClientContext context;
     skinny::Content res;
     req.set_session_id(session_id);
     req.set_fh(fh);
-    auto status = InvokeRpc([&]() {
-      ClientContext context;
-      return stub_->GetContent(&context, req, &res);
+    req.set_min_log_idx(seen_log_idx_.load());
+    if (hedge_reads_ && observer_ < 0) {
+      res = HedgedGetContent(req);
+    } else {
+      auto status = InvokeRead([&](auto *stub, ClientContext &context) {
+        return stub->GetContent(&context, req, &res);
+      });
+      check(status);
+    }
+    if (path) fill_cache(path.value(), invalidations, res);
+    if (content_gen) *content_gen = res.content_gen();
+    return res.content();
+  }
+
+  std::vector<int> OpenMany(const std::vector<std::string> &paths,
+                            const std::optional<std::function<void(int)>> &cb,
+                            bool is_ephemeral) {
+    skinny::OpenManyReq req;
+    skinny::Handles res;
+    req.set_session_id(session_id);
+    req.set_is_ephemeral(is_ephemeral);
+    for (auto &path : paths) req.add_paths(path);
+    auto status = InvokeRpc([&](ClientContext &context) {
+      return stub()->OpenMany(&context, req, &res);
     });
-    assert(status.ok());
-    {
-      std::lock_guard lg(cache_lock_);
-      cache_[fh] = res.content();
+    check(status);
+    std::vector<int> fhs(res.fhs().begin(), res.fhs().end());
+    for (int i = 0; i < fhs.size(); ++i) add_handle(fhs[i], paths[i], cb);
+    return fhs;
+  }
+
+  std::vector<std::string> GetContentMany(const std::vector<int> &fhs) {
+    std::vector<std::string> contents(fhs.size());
+    skinny::GetContentManyReq req;
+    skinny::Contents res;
+    std::vector<int> missed;  // index into fhs
+    std::vector<std::optional<std::string>> paths;
+    for (int i = 0; i < fhs.size(); ++i) {
+      std::optional<CachedContent> cached;
+      paths.push_back(path_of(fhs[i]));
+      if (paths[i] && has_conn_.load() == true &&
+          (cached = cache_.get(paths[i].value()))) {
+        contents[i] = std::move(cached->content);
+      } else {
+        missed.push_back(i);
+        req.add_fhs(fhs[i]);
+      }
+    }
+    if (missed.empty()) return contents;
+    int invalidations = invalidations_.load();
+    req.set_session_id(session_id);
+    req.set_min_log_idx(seen_log_idx_.load());
+    auto status = InvokeRead([&](auto *stub, ClientContext &context) {
+      return stub->GetContentMany(&context, req, &res);
+    });
+    check(status);
+    for (int i = 0; i < missed.size(); ++i) {
+      auto &c = res.contents(i);
+      contents[missed[i]] = c.content();
+      if (auto &path = paths[missed[i]]) {
+        fill_cache(path.value(), invalidations, c);
+      }
     }
+    return contents;
+  }
+
+  void CloseMany(const std::vector<int> &fhs) {
+    skinny::CloseManyReq req;
+    skinny::Empty res;
+    req.set_session_id(session_id);
+    for (auto fh : fhs) req.add_fhs(fh);
+    auto status = InvokeRpc([&](ClientContext &context) {
+      return stub()->CloseMany(&context, req, &res);
+    });
+    for (auto fh : fhs) remove_handle(fh);
+  }
+
+  std::optional<std::string> GetContentByPath(const std::string &path,
+                                              bool watch) {
+    if (watch && has_conn_.load() == true) {
+      if (auto cached = cache_.get(path)) return cached->content;
+    }
+    int invalidations = invalidations_.load();
+    skinny::GetContentByPathReq req;
+    skinny::Content res;
+    req.set_session_id(session_id);
+    req.set_path(path);
+    req.set_watch(watch);
+    req.set_min_log_idx(seen_log_idx_.load());
+    auto read = [&](skinny::Skinny::Stub *stub, ClientContext &context) {
+      return stub->GetContentByPath(&context, req, &res);
+    };
+    grpc::Status status;
+    if (watch) {  // only the leader takes watches
+      status = InvokeRpc(
+          [&](ClientContext &context) { return read(stub(), context); });
+    } else {
+      status = InvokeRead(read);
+    }
+    if (status.error_code() == grpc::StatusCode::NOT_FOUND) {
+      return std::nullopt;
+    }
+    check(status);
+    if (watch) fill_cache(path, invalidations, res);
     return res.content();
   }
 
@@ -128,11 +373,10 @@ class SkinnyClient::impl {
     req.set_session_id(session_id);
     req.set_content(content);
     req.set_fh(fh);
-    auto status = InvokeRpc([&]() {
-      ClientContext context;
-      return stub_->SetContent(&context, req, &res);
+    auto status = InvokeRpc([&](ClientContext &context) {
+      return stub()->SetContent(&context, req, &res);
     });
-    assert(status.ok());
+    check(status);
   }
 
   bool TryAcquire(int fh, bool ex) {
@@ -142,13 +386,12 @@ class SkinnyClient::impl {
     req.set_session_id(session_id);
     req.set_fh(fh);
     req.set_ex(ex);
-    auto status = InvokeRpc([&]() {
-      ClientContext context;
-      return stub_->TryAcquire(&context, req, &res);
+    auto status = InvokeRpc([&](ClientContext &context) {
+      return stub()->TryAcquire(&context, req, &res);
     });
     // std::cout << status.error_code() << ": " << status.error_message() <<
     // std::endl;
-    assert(status.ok());
+    check(status);
     return (res.res() == 0);
   }
 
@@ -159,11 +402,13 @@ class SkinnyClient::impl {
     req.set_session_id(session_id);
     req.set_fh(fh);
     req.set_ex(ex);
-    auto status = InvokeRpc([&]() {
-      ClientContext context;
-      return stub_->Acquire(&context, req, &res);
-    });
-    assert(status.ok());
+    // Waits for the lock as long as it takes, so it has no deadline
+    auto status = InvokeRpc(
+        [&](ClientContext &context) {
+          return stub()->Acquire(&context, req, &res);
+        },
+        false);
+    check(status);
     return (res.res() == 0);
   }
 
@@ -173,11 +418,56 @@ class SkinnyClient::impl {
     skinny::Response res;
     req.set_session_id(session_id);
     req.set_fh(fh);
-    auto status = InvokeRpc([&]() {
-      ClientContext context;
-      return stub_->Release(&context, req, &res);
+    auto status = InvokeRpc([&](ClientContext &context) {
+      return stub()->Release(&context, req, &res);
     });
-    assert(status.ok());
+    check(status);
+  }
+
+  TxnResult Txn(const std::vector<TxnGuard> &guards,
+                const std::vector<TxnOp> &ops) {
+    skinny::TxnReq req;
+    skinny::TxnRes res;
+    req.set_session_id(session_id);
+    for (auto &g : guards) {
+      auto *guard = req.add_guards();
+      guard->set_type(static_cast<skinny::TxnGuard::Type>(g.type));
+      guard->set_fh(g.fh);
+      guard->set_path(g.path);
+      guard->set_value(g.value);
+    }
+    for (auto &o : ops) {
+      auto *op = req.add_ops();
+      op->set_type(static_cast<skinny::TxnOp::Type>(o.type));
+      op->set_fh(o.fh);
+      op->set_path(o.path);
+      op->set_content(o.content);
+      op->set_is_directory(o.is_directory);
+      op->set_is_ephemeral(o.is_ephemeral);
+    }
+    auto status = InvokeRpc([&](ClientContext &context) {
+      return stub()->Txn(&context, req, &res);
+    });
+    check(status);
+    TxnResult result{res.succeeded(), res.failed_guard(),
+                     std::vector<int>(res.fhs().begin(), res.fhs().end())};
+    if (!result.succeeded) return result;
+    auto fh_it = result.fhs.begin();
+    for (auto &o : ops) {
+      if (o.type == TxnOp::OPEN) {
+        add_handle(*fh_it++, o.path, std::nullopt);
+      } else if (o.type == TxnOp::CLOSE) {
+        remove_handle(o.fh);
+      } else if (o.type == TxnOp::DELETE) {
+        invalidate(o.path.empty() ? path_of(o.fh) : o.path);
+      }
+    }
+    return result;
+  }
+
+  CacheStats GetCacheStats() const {
+    auto stats = cache_.stats();
+    return {stats.hits, stats.misses, stats.evictions, stats.bytes};
   }
 
   void Delete(int fh) {
@@ -186,26 +476,429 @@ class SkinnyClient::impl {
     skinny::Response res;
     req.set_session_id(session_id);
     req.set_fh(fh);
-    auto status = InvokeRpc([&]() {
-      ClientContext context;
-      return stub_->Delete(&context, req, &res);
+    auto status = InvokeRpc([&](ClientContext &context) {
+      return stub()->Delete(&context, req, &res);
     });
-    assert(status.ok());
+    check(status);
+    invalidate(path_of(fh));
+  }
+
+  void OpenAsync(const std::string &path, bool is_ephemeral,
+                 AsyncCallback<int> done) {
+    skinny::OpenReq req;
+    req.set_path(path);
+    req.set_session_id(session_id);
+    req.set_is_ephemeral(is_ephemeral);
+    CallAsync<int>(
+        &skinny::Skinny::Stub::PrepareAsyncOpen, std::move(req),
+        [this, path](skinny::Handle &res) {
+          add_handle(res.fh(), path, std::nullopt);
+          return res.fh();
+        },
+        std::move(done));
+  }
+
+  // Like Close, fails only if the session is gone, and otherwise drops the
+  // handle whatever the reply
+  void CloseAsync(int fh, AsyncCallback<void> done) {
+    skinny::CloseReq req;
+    req.set_session_id(session_id);
+    req.set_fh(fh);
+    CallAsync<void>(
+        &skinny::Skinny::Stub::PrepareAsyncClose, std::move(req),
+        [](skinny::Empty &) {},
+        [this, fh, done = std::move(done)](std::future<void> result) {
+          try {
+            result.get();
+          } catch (const SkinnyError &e) {
+            if (e.what() == SESSION_NOT_FOUND_STR) {
+              std::promise<void> failed;
+              failed.set_exception(std::current_exception());
+              return done(failed.get_future());
+            }
+          }
+          remove_handle(fh);
+          std::promise<void> closed;
+          closed.set_value();
+          done(closed.get_future());
+        });
+  }
+
+  void GetContentAsync(int fh, AsyncCallback<std::string> done) {
+    auto path = path_of(fh);
+    if (path && has_conn_.load() == true) {
+      if (auto cached = cache_.get(path.value())) {
+        std::promise<std::string> result;
+        result.set_value(std::move(cached->content));
+        return done(result.get_future());
+      }
+    }
+    int invalidations = invalidations_.load();
+    skinny::GetContentReq req;
+    req.set_session_id(session_id);
+    req.set_fh(fh);
+    CallAsync<std::string>(
+        &skinny::Skinny::Stub::PrepareAsyncGetContent, std::move(req),
+        [this, path, invalidations](skinny::Content &res) {
+          if (path) fill_cache(path.value(), invalidations, res);
+          return std::move(*res.mutable_content());
+        },
+        std::move(done));
+  }
+
+  void SetContentAsync(int fh, const std::string &content,
+                       AsyncCallback<void> done) {
+    skinny::SetContentReq req;
+    req.set_session_id(session_id);
+    req.set_content(content);
+    req.set_fh(fh);
+    CallAsync<void>(
+        &skinny::Skinny::Stub::PrepareAsyncSetContent, std::move(req),
+        [](skinny::Empty &) {}, std::move(done));
+  }
+
+  void AcquireAsync(int fh, bool ex, bool try_only, AsyncCallback<bool> done) {
+    skinny::LockAcqReq req;
+    req.set_session_id(session_id);
+    req.set_fh(fh);
+    req.set_ex(ex);
+    CallAsync<bool>(try_only ? &skinny::Skinny::Stub::PrepareAsyncTryAcquire
+                             : &skinny::Skinny::Stub::PrepareAsyncAcquire,
+                    std::move(req),
+                    [](skinny::Response &res) { return res.res() == 0; },
+                    std::move(done), try_only);
+  }
+
+  void ReleaseAsync(int fh, AsyncCallback<void> done) {
+    skinny::LockRelReq req;
+    req.set_session_id(session_id);
+    req.set_fh(fh);
+    CallAsync<void>(
+        &skinny::Skinny::Stub::PrepareAsyncRelease, std::move(req),
+        [](skinny::Response &) {}, std::move(done));
+  }
+
+  void DeleteAsync(int fh, AsyncCallback<void> done) {
+    skinny::DeleteReq req;
+    req.set_session_id(session_id);
+    req.set_fh(fh);
+    CallAsync<void>(
+        &skinny::Skinny::Stub::PrepareAsyncDelete, std::move(req),
+        [this, fh](skinny::Response &) { invalidate(path_of(fh)); },
+        std::move(done));
   }
 
  private:
-  grpc::Status InvokeRpc(std::function<grpc::Status()> &&fun) {
-    while (true) {
-      while (has_conn_.load() == 0) has_conn_.wait(0);
-      grpc::Status status = std::invoke(fun);
+  static bool IsRetryable(const grpc::Status &status) {
+    return status.error_code() ==
+               static_cast<grpc::StatusCode>(skinny::ErrorCode::NOT_LEADER) ||
+           status.error_code() == grpc::StatusCode::UNAVAILABLE;
+  }
+
+  static void check(const grpc::Status &status) {
+    if (!status.ok()) {
+      throw SkinnyError(status.error_code(), status.error_message());
+    }
+  }
+
+  // A server that does not answer within about an election timeout is likely
+  // down or cut off from the others; the next attempt may find a new leader.
+  static std::chrono::system_clock::time_point AttemptDeadline(
+      std::chrono::system_clock::time_point deadline) {
+    return std::min(deadline,
+                    std::chrono::system_clock::now() + kAttemptTimeout);
+  }
+
+  // Whether an attempt ran out of its own deadline before the call's
+  static bool AttemptTimedOut(
+      const grpc::Status &status,
+      std::optional<std::chrono::system_clock::time_point> deadline) {
+    return deadline &&
+           status.error_code() == grpc::StatusCode::DEADLINE_EXCEEDED &&
+           std::chrono::system_clock::now() < *deadline;
+  }
+
+  // Budget shared by all attempts of a call
+  std::optional<std::chrono::system_clock::time_point> Deadline() const {
+    if (call_timeout_.count() <= 0) return std::nullopt;
+    return std::chrono::system_clock::now() + call_timeout_;
+  }
+
+  // Runs `fun` with a fresh context per attempt until it gets a reply that is
+  // not NOT_LEADER/UNAVAILABLE, or the call's deadline (if `bounded`) passes.
+  grpc::Status InvokeRpc(std::function<grpc::Status(ClientContext &)> &&fun,
+                         bool bounded = true) {
+    return InvokeRpcUntil(std::move(fun), bounded ? Deadline() : std::nullopt);
+  }
+
+  // InvokeRpc with the attempts bounded by `deadline`, if any
+  grpc::Status InvokeRpcUntil(
+      std::function<grpc::Status(ClientContext &)> &&fun,
+      std::optional<std::chrono::system_clock::time_point> deadline) {
+    grpc::Status status(grpc::StatusCode::DEADLINE_EXCEEDED,
+                        "No session with the cell");
+    for (int attempt = 0;; ++attempt) {
+      while (has_conn_.load() == 0) {
+        if (!deadline) {
+          has_conn_.wait(0);
+        } else if (std::chrono::system_clock::now() >= *deadline) {
+          return status;
+        } else {
+          std::this_thread::sleep_for(kMinBackoff);
+        }
+      }
+      int srv = cur_srv_id.load();
+      ClientContext context;
+      if (deadline) context.set_deadline(AttemptDeadline(*deadline));
+      status = fun(context);
       if (!status.ok() && status.error_message() == SESSION_NOT_FOUND_STR) {
-        throw std::runtime_error(SESSION_NOT_FOUND_STR);
-      } else if (!(status.error_code() == static_cast<grpc::StatusCode>(
-                                              skinny::ErrorCode::NOT_LEADER) ||
-                   status.error_code() == grpc::StatusCode::UNAVAILABLE)) {
+        throw SkinnyError(status.error_code(), SESSION_NOT_FOUND_STR);
+      } else if (!IsRetryable(status) && !AttemptTimedOut(status, deadline)) {
         return status;
       }
+      if (!FollowLeaderHint(srv, status)) {
+        auto delay = Backoff(attempt);
+        if (deadline && std::chrono::system_clock::now() + delay >= *deadline) {
+          return status;
+        }
+        std::this_thread::sleep_for(delay);
+      }
+    }
+  }
+
+  // Sends a read to the observer, if any, and else (or if the observer is
+  // down or behind) to the leader. The read asks for the log applied at least
+  // as far as every invalidation seen so far, so its reply can be cached.
+  // Both share the call's deadline.
+  grpc::Status InvokeRead(
+      const std::function<grpc::Status(skinny::Skinny::Stub *,
+                                       ClientContext &)> &fun) {
+    auto deadline = Deadline();
+    if (observer_ >= 0 && has_conn_.load()) {
+      ClientContext context;
+      if (deadline) context.set_deadline(*deadline);
+      auto status = fun(members_[observer_].stub.get(), context);
+      if (!IsRetryable(status)) return status;
+    }
+    return InvokeRpcUntil(
+        [&](ClientContext &context) { return fun(stub(), context); },
+        deadline);
+  }
+
+  // Sends the read again over the second connection if no reply came within
+  // the p95 of recent reads, and takes the first reply. Reads are served by
+  // the leader only, so both go to it.
+  skinny::Content HedgedGetContent(const skinny::GetContentReq &req) {
+    auto [result, done] = AsyncResult<skinny::Content>::Make();
+    auto once = std::make_shared<std::atomic<bool>>(false);
+    auto issue = [&, done = done](bool hedge) {
+      CallAsync<skinny::Content>(
+          &skinny::Skinny::Stub::PrepareAsyncGetContent,
+          skinny::GetContentReq(req),
+          [](skinny::Content &res) { return std::move(res); },
+          [done, once](std::future<skinny::Content> res) {
+            if (!once->exchange(true)) done(std::move(res));
+          },
+          true, hedge);
+    };
+    auto start = std::chrono::steady_clock::now();
+    issue(false);
+    if (!result.wait_for(read_latency_.p95())) issue(true);
+    auto res = result.get();
+    read_latency_.add(std::chrono::steady_clock::now() - start);
+    return res;
+  }
+
+  // Jittered exponential backoff before retry number `attempt`
+  static std::chrono::milliseconds Backoff(int attempt) {
+    static thread_local std::mt19937 gen(std::random_device{}());
+    auto cap =
+        std::min(kMaxBackoff, kMinBackoff * (1 << std::min(attempt, 10)));
+    std::uniform_int_distribution<int> jitter(cap.count() / 2, cap.count());
+    return std::chrono::milliseconds(jitter(gen));
+  }
+
+  // Moves to the leader named in a NOT_LEADER reply from server `srv`.
+  // Returns whether there was such a hint, i.e. a retry can go at once.
+  bool FollowLeaderHint(int srv, const grpc::Status &status) {
+    if (status.error_code() !=
+        static_cast<grpc::StatusCode>(skinny::ErrorCode::NOT_LEADER)) {
+      return false;
     }
+    int leader = member_of(std::stoi(status.error_message()));
+    if (leader < 0 || leader == srv) return false;
+    if (cur_srv_id.compare_exchange_strong(srv, leader)) cv_.notify_one();
+    return true;
+  }
+
+  // Asks every server for the leader in parallel. Returns the first server
+  // that reports itself as leader, else the one most servers name within
+  // kProbeTimeout, else -1.
+  int ProbeLeader() {
+    struct Probe {
+      explicit Probe(int n) : pending(n), votes(n), res(n), contexts(n) {}
+      std::mutex mu;
+      std::condition_variable cv;
+      int pending;
+      int leader = -1;
+      std::vector<int> votes;
+      diagnostic::Empty req;
+      std::vector<diagnostic::Leader> res;
+      std::vector<ClientContext> contexts;
+    };
+    int n = members_.size();
+    auto probe = std::make_shared<Probe>(n);
+    auto deadline = std::chrono::system_clock::now() + kProbeTimeout;
+    for (int i = 0; i < n; ++i) {
+      probe->contexts[i].set_deadline(deadline);
+      members_[i].diag->async()->GetLeader(
+          &probe->contexts[i], &probe->req, &probe->res[i],
+          [self = this, probe, i](grpc::Status status) {
+            std::lock_guard lg(probe->mu);
+            int leader =
+                status.ok() ? self->member_of(probe->res[i].leader()) : -1;
+            if (leader == i) {
+              probe->leader = i;
+            } else if (leader >= 0 && leader < probe->votes.size()) {
+              ++probe->votes[leader];
+            }
+            --probe->pending;
+            probe->cv.notify_all();
+          });
+    }
+    std::unique_lock ul(probe->mu);
+    probe->cv.wait(
+        ul, [&]() { return probe->pending == 0 || probe->leader >= 0; });
+    if (probe->leader >= 0) return probe->leader;
+    auto most = std::max_element(probe->votes.begin(), probe->votes.end());
+    return *most > 0 ? most - probe->votes.begin() : -1;
+  }
+
+  class AsyncCallBase {
+   public:
+    virtual ~AsyncCallBase() = default;
+    virtual void Proceed() = 0;
+  };
+
+  // An RPC on cq_, retried like InvokeRpc does. While there is no session
+  // or after a retryable error it waits on an alarm, not on a thread.
+  template <typename Req, typename Res>
+  class AsyncCall final : public AsyncCallBase {
+   public:
+    using Prepare = std::unique_ptr<grpc::ClientAsyncResponseReader<Res>> (
+        skinny::Skinny::Stub::*)(ClientContext *, const Req &,
+                                 grpc::CompletionQueue *);
+    using Done = std::function<void(const grpc::Status &, Res &)>;
+
+    AsyncCall(impl *client, Prepare prepare, Req &&req, Done &&done,
+              std::optional<std::chrono::system_clock::time_point> deadline,
+              bool hedge)
+        : client_(client),
+          prepare_(prepare),
+          req_(std::move(req)),
+          done_(std::move(done)),
+          deadline_(deadline),
+          hedge_(hedge) {}
+
+    // Starts the RPC, or arms the alarm to try again later.
+    void Issue(bool backoff) {
+      {
+        std::lock_guard lg(client_->async_lock_);
+        auto now = std::chrono::system_clock::now();
+        auto delay = backoff ? Backoff(attempt_++) : kRetryDelay;
+        if (deadline_ && now + (backoff ? delay : kNoDelay) >= *deadline_) {
+          if (status_.ok()) {
+            status_ = grpc::Status(grpc::StatusCode::DEADLINE_EXCEEDED,
+                                   "No session with the cell");
+          }
+        } else if (!client_->cq_shutdown_) {
+          if (backoff || client_->has_conn_.load() == 0) {
+            alarm_.Set(&client_->cq_, now + delay, tag());
+          } else {
+            context_ = std::make_unique<ClientContext>();
+            if (deadline_) context_->set_deadline(AttemptDeadline(*deadline_));
+            client_->async_contexts_.insert(context_.get());
+            srv_ = client_->cur_srv_id.load();
+            auto &member = client_->members_[srv_];
+            auto *stub = hedge_ ? member.hedge_stub.get() : member.stub.get();
+            reader_ = (stub->*prepare_)(context_.get(), req_, &client_->cq_);
+            reader_->StartCall();
+            reader_->Finish(&res_, &status_, tag());
+          }
+          return;
+        } else {
+          status_ = grpc::Status::CANCELLED;
+        }
+      }
+      Complete();
+    }
+
+    void Proceed() override {
+      if (!context_) return Issue(false);  // the alarm fired
+      {
+        std::lock_guard lg(client_->async_lock_);
+        client_->async_contexts_.erase(context_.get());
+      }
+      context_.reset();
+      if (IsRetryable(status_) || AttemptTimedOut(status_, deadline_)) {
+        return Issue(!client_->FollowLeaderHint(srv_, status_));
+      }
+      Complete();
+    }
+
+   private:
+    // Poll interval while there is no session
+    static constexpr auto kRetryDelay = std::chrono::milliseconds(10);
+    static constexpr auto kNoDelay = std::chrono::milliseconds(0);
+
+    void *tag() { return static_cast<AsyncCallBase *>(this); }
+
+    void Complete() {
+      done_(status_, res_);
+      delete this;
+    }
+
+    impl *client_;
+    Prepare prepare_;
+    Req req_;
+    Res res_;
+    Done done_;
+    std::optional<std::chrono::system_clock::time_point> deadline_;
+    bool hedge_;   // use the second connection
+    int srv_ = 0;  // server the last attempt went to
+    int attempt_ = 0;
+    grpc::Status status_;
+    std::unique_ptr<ClientContext> context_;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<Res>> reader_;
+    grpc::Alarm alarm_;
+  };
+
+  // Runs the RPC on cq_ and completes `done` with `get(res)`, or with the
+  // error the blocking call would have raised.
+  template <typename T, typename Req, typename Res, typename Get>
+  void CallAsync(std::unique_ptr<grpc::ClientAsyncResponseReader<Res>> (
+                     skinny::Skinny::Stub::*prepare)(
+                     ClientContext *, const Req &, grpc::CompletionQueue *),
+                 Req &&req, Get &&get, AsyncCallback<T> &&done,
+                 bool bounded = true, bool hedge = false) {
+    auto call = new AsyncCall<Req, Res>(
+        this, prepare, std::move(req),
+        [get = std::move(get), done = std::move(done)](
+            const grpc::Status &status, Res &res) {
+          std::promise<T> result;
+          if (!status.ok()) {
+            result.set_exception(std::make_exception_ptr(
+                SkinnyError(status.error_code(), status.error_message())));
+          } else if constexpr (std::is_void_v<T>) {
+            get(res);
+            result.set_value();
+          } else {
+            result.set_value(get(res));
+          }
+          done(result.get_future());
+        },
+        bounded ? Deadline() : std::nullopt, hedge);
+    call->Issue(false);
   }
 
   std::optional<int> KeepAlive(std::optional<int> eid) {
@@ -217,77 +910,152 @@ class SkinnyClient::impl {
     context.set_deadline(deadline);
     req.set_session_id(session_id);
     if (eid) req.set_acked_event(eid.value());
+    req.set_term(term_);
 
     std::optional<grpc::Status> status_optional;
     std::mutex mu;
-    stub_cb_->async()->KeepAlive(&context, &req, &res,
-                                 [this, &status_optional, &mu](grpc::Status s) {
-                                   std::lock_guard<std::mutex> lock(mu);
-                                   status_optional = std::move(s);
-                                   cv_.notify_one();
-                                 });
+    int srv = cur_srv_id.load();
+    members_[srv].stub_cb->async()->KeepAlive(
+        &context, &req, &res, [this, &status_optional, &mu](grpc::Status s) {
+          std::lock_guard<std::mutex> lock(mu);
+          status_optional = std::move(s);
+          cv_.notify_one();
+        });
 
     std::unique_lock lock(mu);
     while (!status_optional) {
-      cv_.wait(lock);
-      if (cancelled_.load()) {
+      cv_.wait_for(lock, 100ms);
+      // A call followed a leader hint elsewhere: poll the new server instead
+      if (cancelled_.load() || cur_srv_id.load() != srv) {
         context.TryCancel();
       }
     }
     std::optional<int> new_eid = std::nullopt;
     auto status = status_optional.value();
     if (status.ok()) {
-      if (has_conn_.load() == 0) {
-        has_conn_ = 1;
+      failures_ = 0;
+      // Only this thread writes it
+      if (res.log_idx() > seen_log_idx_.load()) {
+        seen_log_idx_ = res.log_idx();
+      }
+      // A new leader has none of the path watches the cache relies on, and
+      // the stream need not have failed if the old one is still up
+      if (has_conn_.load() == 0 || res.term() != term_) {
+        term_ = res.term();
         {
-          std::lock_guard lg(cache_lock_);
+          std::lock_guard lg(fill_lock_);
+          invalidations_++;
           cache_.clear();
         }
+      }
+      if (has_conn_.load() == 0) {
+        has_conn_ = 1;
         has_conn_.notify_all();
       }
-      if (!res.has_fh()) return std::nullopt;
+      if (!res.has_event_id()) return std::nullopt;
       new_eid = res.event_id();
+      if (res.has_path()) {
+        invalidate(res.path());
+        return new_eid;
+      }
+      // The server sends one event per session and file; every handle open
+      // on the file gets its callback.
+      std::vector<std::pair<int, std::function<void(int)>>> to_call;
+      std::optional<std::string> path;
       {
-        std::lock_guard lg(cache_lock_);
-        if (auto it = cache_.find(res.fh()); it != cache_.end()) {
-          cache_.erase(it);
+        std::lock_guard lg(handles_lock_);
+        std::unordered_set<int> fhs{res.fh()};
+        if (auto it = fh_paths_.find(res.fh()); it != fh_paths_.end()) {
+          path = it->second;
+          fhs = path_fhs_.at(it->second);
+        }
+        for (int fh : fhs) {
+          if (auto it = callbacks.find(fh); it != callbacks.end()) {
+            to_call.emplace_back(fh, it->second);
+          }
         }
       }
-      if (auto it = callbacks.find(res.fh()); it != callbacks.end()) {
-        std::thread t(it->second, res.fh());
-        t.detach();
+      invalidate(path);
+      for (auto &[fh, cb] : to_call) {
+        callback_executor_->post(fh, [cb = std::move(cb), fh = fh] { cb(fh); });
       }
     } else {
-      has_conn_ = 0;
-      int next_server_id = cur_srv_id + 1;
-      if (status.error_code() ==
-          static_cast<grpc::StatusCode>(skinny::ErrorCode::NOT_LEADER)) {
-        if (auto new_leader = std::stoi(status.error_message());
-            new_leader != -1)
-          next_server_id = new_leader;
-      } else if (status.error_code() == grpc::StatusCode::CANCELLED &&
-                 cancelled_.load()) {
-        return std::nullopt;
-      } else if (!status.ok() &&
-                 status.error_message() == SESSION_NOT_FOUND_STR) {
+      if (status.error_code() == grpc::StatusCode::CANCELLED) {
+        if (cancelled_.load()) return std::nullopt;
+        if (cur_srv_id.load() != srv) return eid;
+      } else if (status.error_message() == SESSION_NOT_FOUND_STR) {
         cancelled_.store(true);
         return std::nullopt;
       }
-      change_server(next_server_id);
+      has_conn_ = 0;
       std::cout << status.error_code() << ": " << status.error_message()
                 << std::endl;
-      std::this_thread::sleep_for(500ms);
+      if (FollowLeaderHint(srv, status)) return eid;
+      int leader = ProbeLeader();
+      change_server(leader >= 0 ? leader : srv + 1);
+      std::this_thread::sleep_for(Backoff(failures_++));
     }
     return new_eid;
   }
 
+  void fill_cache(const std::string &path, int invalidations,
+                  const skinny::Content &res) {
+    std::lock_guard lg(fill_lock_);
+    if (invalidations == invalidations_.load()) {
+      cache_.put(path, {res.content(), res.content_gen()});
+    }
+  }
+
+  void invalidate(const std::optional<std::string> &path) {
+    if (!path) return;
+    std::lock_guard lg(fill_lock_);
+    invalidations_++;
+    cache_.erase(path.value());
+  }
+
+  void add_handle(int fh, const std::string &path,
+                  const std::optional<std::function<void(int)>> &cb) {
+    std::lock_guard lg(handles_lock_);
+    fh_paths_[fh] = path;
+    path_fhs_[path].insert(fh);
+    if (cb) callbacks[fh] = cb.value();
+  }
+
+  // Once no handle is open on the file, the session gets no more invalidations
+  // for it, so it cannot stay cached.
+  void remove_handle(int fh) {
+    std::optional<std::string> unwatched;
+    {
+      std::lock_guard lg(handles_lock_);
+      callbacks.erase(fh);
+      auto it = fh_paths_.find(fh);
+      if (it == fh_paths_.end()) return;
+      auto &fhs = path_fhs_.at(it->second);
+      fhs.erase(fh);
+      if (fhs.empty()) {
+        unwatched = it->second;
+        path_fhs_.erase(it->second);
+      }
+      fh_paths_.erase(it);
+    }
+    invalidate(unwatched);
+  }
+
+  std::optional<std::string> path_of(int fh) {
+    std::lock_guard lg(handles_lock_);
+    auto it = fh_paths_.find(fh);
+    if (it == fh_paths_.end()) return std::nullopt;
+    return it->second;
+  }
+
   void StartSessionOrDie() {
-    for (int i = 0; i < SRV_CONFIG.size(); ++i) {
-      change_server(i);
+    int first = preferred_ >= 0 ? preferred_ : std::max(ProbeLeader(), 0);
+    for (int i = 0; i < members_.size(); ++i) {
+      change_server(first + i);
       skinny::Empty req;
       ClientContext context;
       skinny::SessionId res;
-      auto status = stub_->StartSession(&context, req, &res);
+      auto status = stub()->StartSession(&context, req, &res);
       if (status.ok()) {
         session_id = res.session_id();
         has_conn_ = true;
@@ -301,57 +1069,335 @@ class SkinnyClient::impl {
 
   void change_server(int server_id) {
     assert(server_id >= 0);
-    cur_srv_id = server_id % SRV_CONFIG.size();
-    channel = grpc::CreateChannel(
-        std::get<0>(SRV_CONFIG[cur_srv_id]) + ":" +
-            std::to_string(std::get<1>(SRV_CONFIG[cur_srv_id]) + 1),
-        grpc::InsecureChannelCredentials());
-    stub_ = skinny::Skinny::NewStub(channel);
-    stub_cb_ = skinny::SkinnyCb::NewStub(channel);
-    return;
+    cur_srv_id = server_id % members_.size();
+  }
+
+  // Index in members_ of the observer to read from, or -1
+  int PickObserver(const SkinnyClientOptions &options) const {
+    if (!options.read_from_observer) return -1;
+    if (options.observer_id >= 0) return member_of(options.observer_id);
+    std::vector<int> observers;
+    for (int i = 0; i < members_.size(); ++i) {
+      if (members_[i].learner) observers.push_back(i);
+    }
+    if (observers.empty()) return -1;
+    std::mt19937 gen(std::random_device{}());
+    return observers[std::uniform_int_distribution<int>(
+        0, observers.size() - 1)(gen)];
   }
 
-  int cur_srv_id;
-  std::shared_ptr<grpc::Channel> channel;
+  // Index in members_ of the server with Raft id `id`, or -1
+  int member_of(int id) const {
+    for (int i = 0; i < members_.size(); ++i) {
+      if (members_[i].id == id) return i;
+    }
+    return -1;
+  }
+
+  skinny::Skinny::Stub *stub() { return members_[cur_srv_id].stub.get(); }
+
+  // A channel to every server, created once and kept across leader changes
+  struct Member {
+    int id;  // Raft server id
+    bool learner;
+    std::shared_ptr<grpc::Channel> channel;
+    std::unique_ptr<skinny::Skinny::Stub> stub;
+    std::unique_ptr<skinny::SkinnyCb::Stub> stub_cb;
+    std::unique_ptr<diagnostic::Diagnostic::Stub> diag;
+    // On a connection of its own, for hedged reads
+    std::unique_ptr<skinny::Skinny::Stub> hedge_stub;
+  };
+
+  static std::vector<Member> ConnectAll() {
+    std::vector<Member> members;
+    for (auto &[id, host, port, learner] : SRV_CONFIG) {
+      auto channel =
+          grpc::CreateChannel(host + ":" + std::to_string(port + 1),
+                              grpc::InsecureChannelCredentials());
+      grpc::ChannelArguments args;
+      args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+      auto hedge_channel = grpc::CreateCustomChannel(
+          host + ":" + std::to_string(port + 1),
+          grpc::InsecureChannelCredentials(), args);
+      members.push_back({id, learner, channel,
+                         skinny::Skinny::NewStub(channel),
+                         skinny::SkinnyCb::NewStub(channel),
+                         diagnostic::Diagnostic::NewStub(channel),
+                         skinny::Skinny::NewStub(hedge_channel)});
+    }
+    return members;
+  }
+
+  static constexpr auto kMinBackoff = std::chrono::milliseconds(10);
+  static constexpr auto kMaxBackoff = std::chrono::milliseconds(1000);
+  // Shorter than an election timeout
+  static constexpr auto kProbeTimeout = std::chrono::milliseconds(200);
+  // About the election timeout's upper bound
+  static constexpr auto kAttemptTimeout = std::chrono::milliseconds(500);
+
+  const std::chrono::milliseconds call_timeout_;
+  const bool hedge_reads_;
+  LatencyWindow read_latency_;
+  std::vector<Member> members_;
+  const int observer_;
+  const int preferred_;
+  std::atomic<int> cur_srv_id{0};
+  // Highest log index the leader has reported. Observer reads wait for it.
+  std::atomic<uint64_t> seen_log_idx_{0};
+  int failures_ = 0;  // consecutive KeepAlive failures
+  uint64_t term_ = 0;  // of the last KeepAlive reply
+  // Path of every open handle. The cache is keyed by path, so handles to the
+  // same file (possibly of different SkinnyClients) share one entry.
+  std::mutex handles_lock_;
+  std::unordered_map<int, std::string> fh_paths_;
+  std::unordered_map<std::string, std::unordered_set<int>> path_fhs_;
   std::unordered_map<int, std::function<void(int)>> callbacks;
-  std::mutex cache_lock_;
-  std::unordered_map<int, std::string> cache_;
-  std::unique_ptr<skinny::Skinny::Stub> stub_;
-  std::unique_ptr<skinny::SkinnyCb::Stub> stub_cb_;
+  ReadCache<std::string> cache_;
+  // Bumped by every invalidation, under fill_lock_. A read that raced with
+  // an invalidation does not fill the cache.
+  std::mutex fill_lock_;
+  std::atomic<int> invalidations_{0};
   int session_id;
   std::atomic<bool> has_conn_;
   std::atomic<bool> cancelled_;
   std::condition_variable cv_;
 
+  // Runs event callbacks, those of a handle in order
+  std::optional<CallbackExecutor> callback_executor_;
   std::thread kathread;
+
+  std::shared_ptr<TraceWriter> trace_;
+  uint32_t trace_client_ = 0;
+
+  // Asynchronous calls. Their completions are handled on cq_thread_.
+  grpc::CompletionQueue cq_;
+  std::mutex async_lock_;
+  bool cq_shutdown_ = false;
+  std::unordered_set<ClientContext *> async_contexts_;
+  std::thread cq_thread_;
 };
 
-SkinnyClient::SkinnyClient() { pImpl = std::make_unique<impl>(); };
+SkinnyClient::SkinnyClient() : SkinnyClient(SkinnyClientOptions{}) {}
+SkinnyClient::SkinnyClient(const SkinnyClientOptions &options) {
+  if (options.shared_connection) {
+    pImpl = impl::shared(options);
+  } else {
+    pImpl = std::make_shared<impl>(options);
+  }
+};
 SkinnyClient::~SkinnyClient() = default;
 int SkinnyClient::Open(const std::string &path,
                        const std::optional<std::function<void(int)>> &cb,
                        bool is_ephemeral) {
-  return pImpl->Open(path, cb, false, is_ephemeral);
+  return pImpl->Traced(
+      {.op = TraceOp::OPEN,
+       .flags = uint8_t((is_ephemeral ? TraceRecord::EPHEMERAL : 0) |
+                        (cb ? TraceRecord::CALLBACK : 0)),
+       .paths = {path}},
+      [&] { return pImpl->Open(path, cb, false, is_ephemeral); },
+      [](TraceRecord &r, int fh) { r.results = {fh}; });
 };
 int SkinnyClient::OpenDir(const std::string &path,
                           const std::optional<std::function<void(int)>> &cb,
                           bool is_ephemeral) {
-  return pImpl->Open(path, cb, true, is_ephemeral);
+  return pImpl->Traced(
+      {.op = TraceOp::OPEN,
+       .flags = uint8_t(TraceRecord::DIRECTORY |
+                        (is_ephemeral ? TraceRecord::EPHEMERAL : 0) |
+                        (cb ? TraceRecord::CALLBACK : 0)),
+       .paths = {path}},
+      [&] { return pImpl->Open(path, cb, true, is_ephemeral); },
+      [](TraceRecord &r, int fh) { r.results = {fh}; });
+};
+std::vector<int> SkinnyClient::OpenMany(
+    const std::vector<std::string> &paths,
+    const std::optional<std::function<void(int)>> &cb, bool is_ephemeral) {
+  return pImpl->Traced(
+      {.op = TraceOp::OPEN_MANY,
+       .flags = uint8_t((is_ephemeral ? TraceRecord::EPHEMERAL : 0) |
+                        (cb ? TraceRecord::CALLBACK : 0)),
+       .paths = paths},
+      [&] { return pImpl->OpenMany(paths, cb, is_ephemeral); },
+      [](TraceRecord &r, const std::vector<int> &fhs) { r.results = fhs; });
+}
+std::vector<std::string> SkinnyClient::GetContentMany(
+    const std::vector<int> &fhs) {
+  return pImpl->Traced({.op = TraceOp::GET_CONTENT_MANY, .fhs = fhs},
+                       [&] { return pImpl->GetContentMany(fhs); });
+}
+void SkinnyClient::CloseMany(const std::vector<int> &fhs) {
+  return pImpl->Traced({.op = TraceOp::CLOSE_MANY, .fhs = fhs},
+                       [&] { return pImpl->CloseMany(fhs); });
+}
+std::string SkinnyClient::GetContent(int fh) {
+  return pImpl->Traced({.op = TraceOp::GET_CONTENT, .fhs = {fh}},
+                       [&] { return pImpl->GetContent(fh); });
+};
+std::optional<std::string> SkinnyClient::GetContentByPath(
+    const std::string &path, bool watch) {
+  return pImpl->Traced(
+      {.op = TraceOp::GET_CONTENT_BY_PATH,
+       .flags = uint8_t(watch ? TraceRecord::WATCH : 0),
+       .paths = {path}},
+      [&] { return pImpl->GetContentByPath(path, watch); });
+}
+std::string SkinnyClient::GetContent(int fh, int *content_gen) {
+  return pImpl->Traced({.op = TraceOp::GET_CONTENT, .fhs = {fh}},
+                       [&] { return pImpl->GetContent(fh, content_gen); });
 };
-std::string SkinnyClient::GetContent(int fh) { return pImpl->GetContent(fh); };
 void SkinnyClient::SetContent(int fh, const std::string &content) {
-  return pImpl->SetContent(fh, content);
+  return pImpl->Traced(
+      {.op = TraceOp::SET_CONTENT, .fhs = {fh}, .sizes = {content.size()}},
+      [&] { return pImpl->SetContent(fh, content); });
+}
+bool SkinnyClient::CompareAndSet(int fh, int content_gen,
+                                 const std::string &content) {
+  TxnGuard guard{TxnGuard::CONTENT_GEN_EQ, fh, "", content_gen};
+  TxnOp op{TxnOp::SET_CONTENT, fh, "", content};
+  return Txn({guard}, {op}).succeeded;
+}
+TxnResult SkinnyClient::Txn(const std::vector<TxnGuard> &guards,
+                            const std::vector<TxnOp> &ops) {
+  return pImpl->Traced(
+      {.op = TraceOp::TXN, .guards = guards, .ops = ops},
+      [&] { return pImpl->Txn(guards, ops); },
+      [](TraceRecord &r, const TxnResult &result) { r.results = result.fhs; });
 }
 bool SkinnyClient::TryAcquire(int fh, bool ex) {
-  return pImpl->TryAcquire(fh, ex);
+  return pImpl->Traced(
+      {.op = TraceOp::TRY_ACQUIRE,
+       .flags = uint8_t(ex ? TraceRecord::EXCLUSIVE : 0),
+       .fhs = {fh}},
+      [&] { return pImpl->TryAcquire(fh, ex); });
+}
+void SkinnyClient::Release(int fh) {
+  return pImpl->Traced({.op = TraceOp::RELEASE, .fhs = {fh}},
+                       [&] { return pImpl->Release(fh); });
+}
+bool SkinnyClient::Acquire(int fh, bool ex) {
+  return pImpl->Traced(
+      {.op = TraceOp::ACQUIRE,
+       .flags = uint8_t(ex ? TraceRecord::EXCLUSIVE : 0),
+       .fhs = {fh}},
+      [&] { return pImpl->Acquire(fh, ex); });
+}
+void SkinnyClient::Close(int fh) {
+  return pImpl->Traced({.op = TraceOp::CLOSE, .fhs = {fh}},
+                       [&] { return pImpl->Close(fh); });
+}
+void SkinnyClient::Delete(int fh) {
+  return pImpl->Traced({.op = TraceOp::DELETE, .fhs = {fh}},
+                       [&] { return pImpl->Delete(fh); });
+}
+
+namespace {
+// Adapts a call taking an AsyncCallback to return an AsyncResult instead.
+template <typename T, typename Start>
+AsyncResult<T> AsResult(Start &&start) {
+  auto [result, done] = AsyncResult<T>::Make();
+  start(std::move(done));
+  return result;
+}
+}  // namespace
+
+AsyncResult<int> SkinnyClient::OpenAsync(const std::string &path,
+                                         bool is_ephemeral) {
+  return AsResult<int>([&](AsyncCallback<int> done) {
+    OpenAsync(path, std::move(done), is_ephemeral);
+  });
+}
+void SkinnyClient::OpenAsync(const std::string &path, AsyncCallback<int> done,
+                             bool is_ephemeral) {
+  pImpl->OpenAsync(
+      path, is_ephemeral,
+      pImpl->TracedAsync(
+          {.op = TraceOp::OPEN,
+           .flags = uint8_t(is_ephemeral ? TraceRecord::EPHEMERAL : 0),
+           .paths = {path}},
+          std::move(done)));
+}
+AsyncResult<void> SkinnyClient::CloseAsync(int fh) {
+  return AsResult<void>(
+      [&](AsyncCallback<void> done) { CloseAsync(fh, std::move(done)); });
+}
+void SkinnyClient::CloseAsync(int fh, AsyncCallback<void> done) {
+  pImpl->CloseAsync(fh, pImpl->TracedAsync({.op = TraceOp::CLOSE, .fhs = {fh}},
+                                           std::move(done)));
+}
+AsyncResult<std::string> SkinnyClient::GetContentAsync(int fh) {
+  return AsResult<std::string>([&](AsyncCallback<std::string> done) {
+    GetContentAsync(fh, std::move(done));
+  });
+}
+void SkinnyClient::GetContentAsync(int fh, AsyncCallback<std::string> done) {
+  pImpl->GetContentAsync(
+      fh, pImpl->TracedAsync({.op = TraceOp::GET_CONTENT, .fhs = {fh}},
+                             std::move(done)));
+}
+AsyncResult<void> SkinnyClient::SetContentAsync(int fh,
+                                                const std::string &content) {
+  return AsResult<void>([&](AsyncCallback<void> done) {
+    SetContentAsync(fh, content, std::move(done));
+  });
+}
+void SkinnyClient::SetContentAsync(int fh, const std::string &content,
+                                   AsyncCallback<void> done) {
+  pImpl->SetContentAsync(
+      fh, content,
+      pImpl->TracedAsync(
+          {.op = TraceOp::SET_CONTENT, .fhs = {fh}, .sizes = {content.size()}},
+          std::move(done)));
+}
+AsyncResult<bool> SkinnyClient::TryAcquireAsync(int fh, bool ex) {
+  return AsResult<bool>([&](AsyncCallback<bool> done) {
+    TryAcquireAsync(fh, ex, std::move(done));
+  });
+}
+void SkinnyClient::TryAcquireAsync(int fh, bool ex, AsyncCallback<bool> done) {
+  pImpl->AcquireAsync(
+      fh, ex, true,
+      pImpl->TracedAsync({.op = TraceOp::TRY_ACQUIRE,
+                          .flags = uint8_t(ex ? TraceRecord::EXCLUSIVE : 0),
+                          .fhs = {fh}},
+                         std::move(done)));
+}
+AsyncResult<bool> SkinnyClient::AcquireAsync(int fh, bool ex) {
+  return AsResult<bool>([&](AsyncCallback<bool> done) {
+    AcquireAsync(fh, ex, std::move(done));
+  });
+}
+void SkinnyClient::AcquireAsync(int fh, bool ex, AsyncCallback<bool> done) {
+  pImpl->AcquireAsync(
+      fh, ex, false,
+      pImpl->TracedAsync({.op = TraceOp::ACQUIRE,
+                          .flags = uint8_t(ex ? TraceRecord::EXCLUSIVE : 0),
+                          .fhs = {fh}},
+                         std::move(done)));
+}
+AsyncResult<void> SkinnyClient::ReleaseAsync(int fh) {
+  return AsResult<void>(
+      [&](AsyncCallback<void> done) { ReleaseAsync(fh, std::move(done)); });
+}
+void SkinnyClient::ReleaseAsync(int fh, AsyncCallback<void> done) {
+  pImpl->ReleaseAsync(
+      fh, pImpl->TracedAsync({.op = TraceOp::RELEASE, .fhs = {fh}},
+                             std::move(done)));
+}
+AsyncResult<void> SkinnyClient::DeleteAsync(int fh) {
+  return AsResult<void>(
+      [&](AsyncCallback<void> done) { DeleteAsync(fh, std::move(done)); });
+}
+void SkinnyClient::DeleteAsync(int fh, AsyncCallback<void> done) {
+  pImpl->DeleteAsync(
+      fh, pImpl->TracedAsync({.op = TraceOp::DELETE, .fhs = {fh}},
+                             std::move(done)));
+}
+CacheStats SkinnyClient::GetCacheStats() const {
+  return pImpl->GetCacheStats();
 }
-void SkinnyClient::Release(int fh) { return pImpl->Release(fh); }
-bool SkinnyClient::Acquire(int fh, bool ex) { return pImpl->Acquire(fh, ex); }
-void SkinnyClient::Close(int fh) { return pImpl->Close(fh); }
-void SkinnyClient::Delete(int fh) { return pImpl->Delete(fh); }
 
 SkinnyDiagnosticClient::SkinnyDiagnosticClient() {
-  for (auto &[host, port] : SRV_CONFIG) {
+  for (auto &[id, host, port, learner] : SRV_CONFIG) {
     stubs_.push_back(diagnostic::Diagnostic::NewStub(
         grpc::CreateChannel(host + ":" + std::to_string(port + 1),
                             grpc::InsecureChannelCredentials())));
@@ -374,3 +1420,110 @@ int SkinnyDiagnosticClient::GetLeader() {
     idx = (idx + 1) % stubs_.size();
   }
 }
+
+// Membership changes go to the leader, which may change under us
+void SkinnyDiagnosticClient::CallLeader(
+    const std::function<grpc::Status(diagnostic::Diagnostic::Stub *,
+                                     ClientContext *)> &call) {
+  using namespace std::chrono_literals;
+  grpc::Status status;
+  for (int attempt = 0; attempt < 10; ++attempt) {
+    int leader = GetLeader();
+    for (int i = 0; i < SRV_CONFIG.size(); ++i) {
+      if (SRV_CONFIG[i].id != leader) continue;
+      ClientContext context;
+      context.set_deadline(std::chrono::system_clock::now() + 10s);
+      status = call(stubs_[i].get(), &context);
+      if (status.ok()) return;
+    }
+    std::this_thread::sleep_for(100ms);
+  }
+  throw SkinnyError(status.error_code(), status.error_message());
+}
+
+void SkinnyDiagnosticClient::AddServer(int id, const std::string &host,
+                                       int port, bool learner) {
+  diagnostic::Server req;
+  req.set_id(id);
+  req.set_host(host);
+  req.set_port(port);
+  req.set_learner(learner);
+  diagnostic::Empty res;
+  CallLeader([&](auto *stub, auto *context) {
+    return stub->AddServer(context, req, &res);
+  });
+}
+
+void SkinnyDiagnosticClient::RemoveServer(int id) {
+  diagnostic::ServerId req;
+  req.set_id(id);
+  diagnostic::Empty res;
+  CallLeader([&](auto *stub, auto *context) {
+    return stub->RemoveServer(context, req, &res);
+  });
+}
+
+void SkinnyDiagnosticClient::YieldLeadership() {
+  diagnostic::Empty req;
+  diagnostic::Empty res;
+  CallLeader([&](auto *stub, auto *context) {
+    return stub->YieldLeadership(context, req, &res);
+  });
+}
+
+std::vector<ServerConfig> SkinnyDiagnosticClient::GetMembers() {
+  diagnostic::Empty req;
+  diagnostic::Members res;
+  CallLeader([&](auto *stub, auto *context) {
+    return stub->GetMembers(context, req, &res);
+  });
+  std::vector<ServerConfig> members;
+  for (auto &server : res.servers()) {
+    members.push_back(
+        {server.id(), server.host(), server.port(), server.learner()});
+  }
+  return members;
+}
+
+void SkinnyDiagnosticClient::CallServer(
+    int id, const std::function<grpc::Status(diagnostic::Diagnostic::Stub *,
+                                             grpc::ClientContext *)> &call) {
+  using namespace std::chrono_literals;
+  for (int i = 0; i < SRV_CONFIG.size(); ++i) {
+    if (SRV_CONFIG[i].id != id) continue;
+    ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + 10s);
+    auto status = call(stubs_[i].get(), &context);
+    if (!status.ok()) {
+      throw SkinnyError(status.error_code(), status.error_message());
+    }
+    return;
+  }
+  throw SkinnyError(grpc::StatusCode::INVALID_ARGUMENT,
+                    "Server " + std::to_string(id) + " is not in the config");
+}
+
+diagnostic::Stats SkinnyDiagnosticClient::GetStats(int id) {
+  diagnostic::Stats res;
+  CallServer(id, [&](auto *stub, auto *context) {
+    return stub->GetStats(context, diagnostic::Empty(), &res);
+  });
+  return res;
+}
+
+void SkinnyDiagnosticClient::SetProfiling(int id, uint32_t sample_every) {
+  diagnostic::Profiling req;
+  req.set_sample_every(sample_every);
+  diagnostic::Empty res;
+  CallServer(id, [&](auto *stub, auto *context) {
+    return stub->SetProfiling(context, req, &res);
+  });
+}
+
+std::string SkinnyDiagnosticClient::GetProfile(int id) {
+  diagnostic::Profile res;
+  CallServer(id, [&](auto *stub, auto *context) {
+    return stub->GetProfile(context, diagnostic::Empty(), &res);
+  });
+  return res.chrome_trace();
+}
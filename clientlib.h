@@ -1,13 +1,111 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
 #include <experimental/propagate_const>
 #include <functional>
 #include <memory>
 #include <optional>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <vector>
+
+#include "clientlib_async.h"
+
+// A guard or operation of SkinnyClient::Txn. It targets `path` when it is
+// non-empty, and the file handle `fh` otherwise. A handle's file counts as
+// gone once it is deleted, even if its path is created again. Ops are
+// checked in order, each against the state the ops before it leave.
+struct TxnGuard {
+  enum Type { EXISTS, NOT_EXISTS, CONTENT_GEN_EQ, NOT_LOCKED, LOCKED_BY_ME };
+  Type type;
+  int fh = -1;
+  std::string path;
+  int value = 0;  // expected content generation for CONTENT_GEN_EQ
+};
+
+struct TxnOp {
+  enum Type { SET_CONTENT, OPEN, DELETE, CLOSE };
+  Type type;
+  int fh = -1;
+  std::string path;
+  std::string content;
+  bool is_directory = false;
+  bool is_ephemeral = false;
+};
+
+struct TxnResult {
+  bool succeeded;
+  int failed_guard;      // index of the first guard that did not hold
+  std::vector<int> fhs;  // handles created by OPEN ops, in order
+};
+
+// Raised by a SkinnyClient call that failed. code() is the gRPC status code
+// (or skinny::ErrorCode) of its last attempt; DEADLINE_EXCEEDED (4) when its
+// retries ran out of SkinnyClientOptions::call_timeout.
+class SkinnyError : public std::runtime_error {
+ public:
+  SkinnyError(int code, const std::string &message)
+      : std::runtime_error(message), code_(code) {}
+  int code() const { return code_; }
+
+ private:
+  int code_;
+};
+
+struct SkinnyClientOptions {
+  // Content bytes cached by the client
+  size_t cache_bytes = 64 << 20;
+  int cache_shards = 16;
+  // Share one process-wide session, KeepAlive stream and cache with every
+  // other SkinnyClient that sets this. The first one's options apply. Locks
+  // belong to the session, so such clients also share the locks they hold.
+  bool shared_connection = false;
+  // Budget of a call, including retries on a leader change. Zero for none.
+  // An attempt that gets no reply within about an election timeout is
+  // retried. Acquire waits for the lock however long it takes.
+  std::chrono::milliseconds call_timeout{10000};
+  // Send a GetContent that misses the cache again, over a second connection,
+  // when it takes longer than the p95 of recent ones.
+  bool hedge_reads = false;
+  // Send blocking reads to an observer, a learner in the cluster config:
+  // `observer_id`, or a random one if it is -1. Writes and watched
+  // GetContentByPath calls still go to the leader, and so do reads the
+  // observer is too far behind for. Reads are not hedged then.
+  bool read_from_observer = false;
+  int observer_id = -1;
+  // Raft id of the server to send calls to, e.g. the nearest one. Servers
+  // forward to the leader what they cannot serve themselves. By default, and
+  // once that server fails, calls go straight to the leader.
+  int preferred_server = -1;
+  // Event callbacks run on this many threads. The callbacks of one handle
+  // run one at a time, in the order of their events.
+  int callback_threads = 4;
+  // Events waiting for a callback thread. Beyond it, the client stops
+  // reading events, and acks no more of them, until callbacks catch up.
+  // So a callback must not wait on a call of its own client that changes a
+  // file (SetContent, Delete, Txn, ...): the server answers it only once
+  // every session has acked the change, this one included, which may never
+  // happen if callbacks are what it waits for. Hand such calls to another
+  // thread.
+  size_t max_queued_callbacks = 1 << 16;
+  // Record every call, with its time but not the contents, to this file
+  // (see clientlib_trace.h). $SKINNY_TRACE sets it for every client.
+  std::string trace_path;
+};
+
+struct CacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t bytes;
+};
 
 class SkinnyClient {
  public:
   SkinnyClient();
+  explicit SkinnyClient(const SkinnyClientOptions &options);
   ~SkinnyClient();
 
   int Open(const std::string &path,
@@ -17,14 +115,59 @@ class SkinnyClient {
               const std::optional<std::function<void(int)>> &cb = std::nullopt,
               bool is_ephemeral = false);
   void Close(int fh);
+  // Batched variants: one round trip, and one Raft entry for opens/closes.
+  std::vector<int> OpenMany(
+      const std::vector<std::string> &paths,
+      const std::optional<std::function<void(int)>> &cb = std::nullopt,
+      bool is_ephemeral = false);
+  std::vector<std::string> GetContentMany(const std::vector<int> &fhs);
+  void CloseMany(const std::vector<int> &fhs);
   std::string GetContent(int fh);
+  std::string GetContent(int fh, int *content_gen);
+  // Reads without opening a handle, and without a Raft entry. With `watch`,
+  // the content is cached until the server invalidates it.
+  // Returns std::nullopt if the file does not exist.
+  std::optional<std::string> GetContentByPath(const std::string &path,
+                                              bool watch = true);
   void SetContent(int fh, const std::string &content);
+  // Sets the content only if it is still at generation `content_gen`.
+  bool CompareAndSet(int fh, int content_gen, const std::string &content);
+  // Applies all ops atomically in one Raft entry if every guard holds.
+  TxnResult Txn(const std::vector<TxnGuard> &guards,
+                const std::vector<TxnOp> &ops);
   bool TryAcquire(int fh, bool ex);
   bool Acquire(int fh, bool ex);
   void Release(int fh);
   void Delete(int fh);
 
+  // Asynchronous variants: they return at once, and the RPC is retried on a
+  // leader change like the blocking call. Callbacks run on the client's
+  // completion queue thread (or the caller's, on a cache hit) and must not
+  // block on a result of the same client. Results can be co_awaited. They
+  // fail on the errors the blocking call raises, and only on those.
+  AsyncResult<int> OpenAsync(const std::string &path,
+                             bool is_ephemeral = false);
+  void OpenAsync(const std::string &path, AsyncCallback<int> done,
+                 bool is_ephemeral = false);
+  AsyncResult<void> CloseAsync(int fh);
+  void CloseAsync(int fh, AsyncCallback<void> done);
+  AsyncResult<std::string> GetContentAsync(int fh);
+  void GetContentAsync(int fh, AsyncCallback<std::string> done);
+  AsyncResult<void> SetContentAsync(int fh, const std::string &content);
+  void SetContentAsync(int fh, const std::string &content,
+                       AsyncCallback<void> done);
+  AsyncResult<bool> TryAcquireAsync(int fh, bool ex);
+  void TryAcquireAsync(int fh, bool ex, AsyncCallback<bool> done);
+  AsyncResult<bool> AcquireAsync(int fh, bool ex);
+  void AcquireAsync(int fh, bool ex, AsyncCallback<bool> done);
+  AsyncResult<void> ReleaseAsync(int fh);
+  void ReleaseAsync(int fh, AsyncCallback<void> done);
+  AsyncResult<void> DeleteAsync(int fh);
+  void DeleteAsync(int fh, AsyncCallback<void> done);
+
+  CacheStats GetCacheStats() const;
+
  private:
   class impl;
-  std::experimental::propagate_const<std::unique_ptr<impl>> pImpl;
+  std::experimental::propagate_const<std::shared_ptr<impl>> pImpl;
 };
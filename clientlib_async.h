@@ -0,0 +1,107 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+// Completion callback of an asynchronous SkinnyClient call. It gets the
+// result as a ready future, whose get() rethrows the call's error.
+template <typename T>
+using AsyncCallback = std::function<void(std::future<T>)>;
+
+// Result of an asynchronous SkinnyClient call. Like a std::future, get()
+// blocks and rethrows the call's error. It can also be co_awaited: the
+// coroutine resumes on the thread that completes the call, or through its
+// promise's schedule() if it has one (see clientlib_coro.h).
+template <typename T>
+class AsyncResult {
+ public:
+  // A pending result, and the callback that completes it
+  static std::pair<AsyncResult, AsyncCallback<T>> Make() {
+    auto state = std::make_shared<State>();
+    return {AsyncResult(state), [state](std::future<T> result) {
+              state->Complete(std::move(result));
+            }};
+  }
+
+  AsyncResult() = default;
+
+  bool valid() const { return state_ != nullptr; }
+  bool is_ready() const {
+    std::lock_guard lg(state_->mutex);
+    return state_->result.has_value();
+  }
+  void wait() const {
+    std::unique_lock ul(state_->mutex);
+    state_->cv.wait(ul, [this]() { return state_->result.has_value(); });
+  }
+  template <typename Rep, typename Period>
+  bool wait_for(const std::chrono::duration<Rep, Period> &timeout) const {
+    std::unique_lock ul(state_->mutex);
+    return state_->cv.wait_for(
+        ul, timeout, [this]() { return state_->result.has_value(); });
+  }
+  T get() {
+    wait();
+    return state_->result->get();
+  }
+  // Hands the result to `fn` once it is ready: right away on this thread if
+  // it already is, else on the thread that completes the call. Like get(),
+  // it consumes the result; this AsyncResult is no longer valid() after.
+  void then(AsyncCallback<T> fn) {
+    auto state = std::move(state_);
+    std::unique_lock ul(state->mutex);
+    if (!state->result) {
+      state->continuation = [state, fn = std::move(fn)]() {
+        fn(std::move(*state->result));
+      };
+      return;
+    }
+    ul.unlock();
+    fn(std::move(*state->result));
+  }
+
+  bool await_ready() const { return is_ready(); }
+  template <typename Promise>
+  bool await_suspend(std::coroutine_handle<Promise> h) {
+    std::lock_guard lg(state_->mutex);
+    if (state_->result) return false;
+    if constexpr (requires(Promise &p) { p.schedule(h); }) {
+      state_->continuation = [h]() { h.promise().schedule(h); };
+    } else {
+      state_->continuation = [h]() { h.resume(); };
+    }
+    return true;
+  }
+  T await_resume() { return state_->result->get(); }
+
+ private:
+  struct State {
+    void Complete(std::future<T> r) {
+      std::function<void()> next;
+      {
+        std::lock_guard lg(mutex);
+        result = std::move(r);
+        next = std::move(continuation);
+      }
+      cv.notify_all();
+      if (next) next();
+    }
+
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::optional<std::future<T>> result;
+    std::function<void()> continuation;
+  };
+
+  explicit AsyncResult(std::shared_ptr<State> state)
+      : state_(std::move(state)) {}
+
+  std::shared_ptr<State> state_;
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct CachedContent {
+  std::string content;
+  int content_gen;
+};
+
+// Read cache bounded to `budget_bytes` of content. Keys are hashed onto
+// shards, each with its own lock and LRU list, so readers of different keys
+// rarely contend. An entry larger than a shard's budget is not cached.
+template <typename Key>
+class ReadCache {
+ public:
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t bytes = 0;
+  };
+
+  ReadCache(size_t budget_bytes, int num_shards)
+      : shard_budget_(budget_bytes / std::max(num_shards, 1)),
+        shards_(std::max(num_shards, 1)) {}
+
+  std::optional<CachedContent> get(const Key &key) {
+    auto &shard = shard_of(key);
+    std::lock_guard lg(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+      shard.misses.fetch_add(1, std::memory_order_relaxed);
+      return std::nullopt;
+    }
+    shard.hits.fetch_add(1, std::memory_order_relaxed);
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return it->second->second;
+  }
+
+  void put(const Key &key, CachedContent value) {
+    auto &shard = shard_of(key);
+    std::lock_guard lg(shard.mutex);
+    erase_locked(shard, key);
+    if (value.content.size() > shard_budget_) return;
+    shard.bytes += value.content.size();
+    shard.lru.emplace_front(key, std::move(value));
+    shard.index[key] = shard.lru.begin();
+    while (shard.bytes > shard_budget_) {
+      auto &victim = shard.lru.back();
+      shard.bytes -= victim.second.content.size();
+      shard.index.erase(victim.first);
+      shard.lru.pop_back();
+      shard.evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void erase(const Key &key) {
+    auto &shard = shard_of(key);
+    std::lock_guard lg(shard.mutex);
+    erase_locked(shard, key);
+  }
+
+  void clear() {
+    for (auto &shard : shards_) {
+      std::lock_guard lg(shard.mutex);
+      shard.lru.clear();
+      shard.index.clear();
+      shard.bytes = 0;
+    }
+  }
+
+  Stats stats() const {
+    Stats s;
+    for (auto &shard : shards_) {
+      s.hits += shard.hits.load(std::memory_order_relaxed);
+      s.misses += shard.misses.load(std::memory_order_relaxed);
+      s.evictions += shard.evictions.load(std::memory_order_relaxed);
+      std::lock_guard lg(shard.mutex);
+      s.bytes += shard.bytes;
+    }
+    return s;
+  }
+
+ private:
+  using Entry = std::pair<Key, CachedContent>;
+  struct Shard {
+    mutable std::mutex mutex;
+    std::list<Entry> lru;  // most recently used first
+    std::unordered_map<Key, typename std::list<Entry>::iterator> index;
+    size_t bytes = 0;
+    std::atomic<uint64_t> hits{0}, misses{0}, evictions{0};
+  };
+
+  Shard &shard_of(const Key &key) {
+    return shards_[std::hash<Key>{}(key) % shards_.size()];
+  }
+
+  void erase_locked(Shard &shard, const Key &key) {
+    if (auto it = shard.index.find(key); it != shard.index.end()) {
+      shard.bytes -= it->second->second.content.size();
+      shard.lru.erase(it->second);
+      shard.index.erase(it);
+    }
+  }
+
+  const size_t shard_budget_;
+  std::vector<Shard> shards_;
+};
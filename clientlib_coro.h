@@ -0,0 +1,232 @@
+#pragma once
+
+#include <grpcpp/alarm.h>
+#include <grpcpp/completion_queue.h>
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "clientlib.h"
+
+// Coroutines over the asynchronous SkinnyClient calls, e.g.
+//
+//   Task<> Bump(SkinnyClient &sc, int fh) {
+//     co_await sc.AcquireAsync(fh, true);
+//     auto n = std::stoi(co_await sc.GetContentAsync(fh));
+//     co_await sc.SetContentAsync(fh, std::to_string(n + 1));
+//     co_await sc.ReleaseAsync(fh);
+//   }
+//
+// run by a CoExecutor: executor.Spawn(Bump(sc, fh)); executor.Wait();
+
+class CoExecutor;
+
+template <typename T = void>
+class Task;
+
+namespace coro_detail {
+
+struct PromiseBase {
+  // Resumes a coroutine of this task on its executor, if any
+  void schedule(std::coroutine_handle<> h);
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<Promise> h) noexcept {
+      return h.promise().continuation;
+    }
+    void await_resume() noexcept {}
+  };
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { error = std::current_exception(); }
+
+  std::coroutine_handle<> continuation = std::noop_coroutine();
+  CoExecutor *executor = nullptr;
+  std::exception_ptr error;
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+  Task<T> get_return_object();
+  void return_value(T v) { value = std::move(v); }
+  T result() {
+    if (error) std::rethrow_exception(error);
+    return std::move(*value);
+  }
+  std::optional<T> value;
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+  Task<void> get_return_object();
+  void return_void() {}
+  void result() {
+    if (error) std::rethrow_exception(error);
+  }
+};
+
+}  // namespace coro_detail
+
+// A lazily started coroutine. It runs when co_awaited, on the awaiting
+// coroutine's executor.
+template <typename T>
+class [[nodiscard]] Task {
+ public:
+  using promise_type = coro_detail::Promise<T>;
+
+  Task(Task &&other) noexcept : h_(std::exchange(other.h_, {})) {}
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (h_) h_.destroy();
+      h_ = std::exchange(other.h_, {});
+    }
+    return *this;
+  }
+  ~Task() {
+    if (h_) h_.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+  template <typename Promise>
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) {
+    h_.promise().continuation = h;
+    if constexpr (std::is_base_of_v<coro_detail::PromiseBase, Promise>) {
+      h_.promise().executor = h.promise().executor;
+    }
+    return h_;
+  }
+  T await_resume() { return h_.promise().result(); }
+
+ private:
+  friend promise_type;
+  friend class CoExecutor;
+  explicit Task(std::coroutine_handle<promise_type> h) : h_(h) {}
+
+  std::coroutine_handle<promise_type> h_;
+};
+
+namespace coro_detail {
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+inline Task<void> Promise<void>::get_return_object() {
+  return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+}  // namespace coro_detail
+
+// Runs tasks on threads draining a gRPC completion queue. A spawned task
+// resumes here after each co_await of an AsyncResult, rather than on the
+// SkinnyClient's own completion queue thread, so it can take its time
+// without delaying the completions of other calls.
+class CoExecutor {
+ public:
+  explicit CoExecutor(int num_threads = 1) {
+    for (int i = 0; i < num_threads; ++i) {
+      threads_.emplace_back([this]() {
+        void *tag;
+        bool ok;
+        while (cq_.Next(&tag, &ok)) {
+          auto *posted = static_cast<Posted *>(tag);
+          auto h = posted->h;
+          delete posted;
+          h.resume();
+        }
+      });
+    }
+  }
+  ~CoExecutor() {
+    WaitIdle();
+    cq_.Shutdown();
+    for (auto &t : threads_) t.join();
+  }
+
+  // Starts `task` on this executor. It is destroyed when it finishes.
+  void Spawn(Task<> task) {
+    {
+      std::lock_guard lg(mutex_);
+      ++running_;
+    }
+    task.h_.promise().executor = this;
+    Run(*this, std::move(task));
+  }
+
+  // Blocks until every spawned task has finished, and rethrows the first
+  // error any of them raised.
+  void Wait() {
+    if (auto error = WaitIdle()) std::rethrow_exception(error);
+  }
+
+  // Resumes `h` on one of the executor's threads
+  void Post(std::coroutine_handle<> h) {
+    auto *posted = new Posted{{}, h};
+    posted->alarm.Set(&cq_, std::chrono::system_clock::now(), posted);
+  }
+
+ private:
+  std::exception_ptr WaitIdle() {
+    std::unique_lock ul(mutex_);
+    cv_.wait(ul, [this]() { return running_ == 0; });
+    return std::exchange(error_, nullptr);
+  }
+
+  struct Posted {
+    grpc::Alarm alarm;
+    std::coroutine_handle<> h;
+  };
+
+  // Owns a spawned task until it finishes
+  struct Detached {
+    struct promise_type {
+      Detached get_return_object() { return {}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() {}
+      void unhandled_exception() { std::terminate(); }
+    };
+  };
+
+  static Detached Run(CoExecutor &self, Task<> task) {
+    struct Schedule {
+      bool await_ready() { return false; }
+      void await_suspend(std::coroutine_handle<> h) { self.Post(h); }
+      void await_resume() {}
+      CoExecutor &self;
+    };
+    co_await Schedule{self};
+    std::exception_ptr error;
+    try {
+      co_await std::move(task);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    std::lock_guard lg(self.mutex_);
+    if (error && !self.error_) self.error_ = error;
+    if (--self.running_ == 0) self.cv_.notify_all();
+  }
+
+  grpc::CompletionQueue cq_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int running_ = 0;
+  std::exception_ptr error_;
+};
+
+inline void coro_detail::PromiseBase::schedule(std::coroutine_handle<> h) {
+  if (executor) {
+    executor->Post(h);
+  } else {
+    h.resume();
+  }
+}
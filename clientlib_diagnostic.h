@@ -1,10 +1,39 @@
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
 #include "includes/diagnostic.grpc.pb.h"
+#include "utils.h"
 
 class SkinnyDiagnosticClient {
  public:
   SkinnyDiagnosticClient();
   int GetLeader();
+  // Adds a server started with --join to the cluster. This and
+  // RemoveServer return once the leader's configuration reflects the change.
+  void AddServer(int id, const std::string &host, int port,
+                 bool learner = false);
+  void RemoveServer(int id);
+  // Moves the leadership off the leader, which stays up as a follower
+  void YieldLeadership();
+  std::vector<ServerConfig> GetMembers();
+  // Counters and gauges of server `id`, see protos/diagnostic.proto
+  diagnostic::Stats GetStats(int id);
+  // Samples one request in `sample_every` on server `id`, 0 to stop
+  void SetProfiling(int id, uint32_t sample_every);
+  // The spans sampled on server `id`, as Chrome trace JSON
+  std::string GetProfile(int id);
 
  private:
+  void CallLeader(const std::function<grpc::Status(
+                      diagnostic::Diagnostic::Stub *, grpc::ClientContext *)>
+                      &call);
+  // Makes `call` on server `id`
+  void CallServer(int id,
+                  const std::function<grpc::Status(
+                      diagnostic::Diagnostic::Stub *, grpc::ClientContext *)>
+                      &call);
+
   std::vector<std::unique_ptr<diagnostic::Diagnostic::Stub>> stubs_;
 };
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Runs event callbacks on a fixed pool of threads. Tasks posted with the
+// same key (a file handle) run one at a time, in the order they were
+// posted; tasks of different keys run in parallel. At most `max_queued`
+// tasks wait, and post() blocks beyond that, except on the executor's own
+// threads: a task that posts more must not wait for the threads (its own
+// included) to make room, so those go past the limit instead.
+class CallbackExecutor {
+ public:
+  CallbackExecutor(int threads, size_t max_queued)
+      : max_queued_(std::max<size_t>(max_queued, 1)) {
+    for (int i = 0; i < std::max(threads, 1); ++i) {
+      threads_.emplace_back([this] { run(); });
+    }
+  }
+
+  // Runs the tasks already posted, then stops the threads
+  ~CallbackExecutor() {
+    {
+      std::lock_guard lg(mutex_);
+      stopped_ = true;
+    }
+    ready_cv_.notify_all();
+    for (auto &t : threads_) t.join();
+  }
+
+  void post(int key, std::function<void()> task) {
+    std::unique_lock ul(mutex_);
+    if (current_ != this) {
+      space_cv_.wait(ul, [this] { return queued_ < max_queued_; });
+    }
+    auto &tasks = keys_[key];
+    tasks.push_back(std::move(task));
+    ++queued_;
+    // Otherwise the key is running or ready already
+    if (tasks.size() == 1) {
+      ready_.push_back(key);
+      ready_cv_.notify_one();
+    }
+  }
+
+ private:
+  void run() {
+    current_ = this;
+    std::unique_lock ul(mutex_);
+    while (true) {
+      ready_cv_.wait(ul, [this] { return stopped_ || !ready_.empty(); });
+      if (ready_.empty()) return;
+      int key = ready_.front();
+      ready_.pop_front();
+      // Left at the front of its key's queue while it runs, which keeps
+      // the key from being made ready again
+      auto &tasks = keys_.at(key);
+      auto task = std::move(tasks.front());
+      ul.unlock();
+      task();
+      task = nullptr;
+      ul.lock();
+      auto it = keys_.find(key);
+      it->second.pop_front();
+      --queued_;
+      space_cv_.notify_one();
+      if (it->second.empty()) {
+        keys_.erase(it);
+      } else {
+        ready_.push_back(key);
+        ready_cv_.notify_one();
+      }
+    }
+  }
+
+  // The executor whose thread this is, if any
+  static inline thread_local const CallbackExecutor *current_ = nullptr;
+
+  const size_t max_queued_;
+  std::mutex mutex_;
+  std::condition_variable ready_cv_;
+  std::condition_variable space_cv_;
+  // Tasks of each key that has some, the first one running or ready
+  std::unordered_map<int, std::deque<std::function<void()>>> keys_;
+  std::deque<int> ready_;  // keys whose first task can run
+  size_t queued_ = 0;
+  bool stopped_ = false;
+  std::vector<std::thread> threads_;
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "clientlib.h"
+
+// A trace of SkinnyClient calls, for replaying real traffic against a test
+// cluster (perf/trace_replay.cpp). Contents are not recorded, only their
+// sizes. The file starts with kTraceMagic, followed by records of varints:
+//   time_us op client flags fhs results paths sizes guards ops
+// where each list is its length and then its elements.
+enum class TraceOp : uint8_t {
+  START,  // a new session
+  END,
+  OPEN,  // also OpenDir, as flags say
+  CLOSE,
+  OPEN_MANY,
+  GET_CONTENT_MANY,
+  CLOSE_MANY,
+  GET_CONTENT,
+  GET_CONTENT_BY_PATH,
+  SET_CONTENT,
+  TXN,  // also CompareAndSet
+  TRY_ACQUIRE,
+  ACQUIRE,
+  RELEASE,
+  DELETE,
+};
+
+struct TraceRecord {
+  enum Flags : uint8_t {
+    DIRECTORY = 1,
+    EPHEMERAL = 2,
+    CALLBACK = 4,  // Open with an event callback
+    WATCH = 8,
+    EXCLUSIVE = 16,
+    ASYNC = 32,
+    FAILED = 64,  // raised a SkinnyError
+  };
+
+  uint64_t time_us = 0;  // when the call was made, since the trace started
+  TraceOp op;
+  uint32_t client = 0;  // one per session in the process
+  uint8_t flags = 0;
+  std::vector<int> fhs;      // handles passed in
+  std::vector<int> results;  // handles returned
+  std::vector<std::string> paths;
+  std::vector<uint64_t> sizes;  // of contents written
+  std::vector<TxnGuard> guards;
+  std::vector<TxnOp> ops;  // contents are replaced by their size in `sizes`
+};
+
+inline constexpr char kTraceMagic[] = "SKINNYTRACE1\n";
+
+// Appends records to a trace file. All clients of a process that trace to
+// the same path share one writer.
+class TraceWriter {
+ public:
+  static std::shared_ptr<TraceWriter> open(const std::string &path) {
+    static std::mutex mutex;
+    static std::map<std::string, std::weak_ptr<TraceWriter>> writers;
+    std::lock_guard lg(mutex);
+    auto writer = writers[path].lock();
+    if (!writer) {
+      writer = std::shared_ptr<TraceWriter>(new TraceWriter(path));
+      writers[path] = writer;
+    }
+    return writer;
+  }
+
+  uint32_t new_client() {
+    std::lock_guard lg(mutex_);
+    return next_client_++;
+  }
+  uint64_t now_us() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - start_)
+        .count();
+  }
+
+  void write(const TraceRecord &r) {
+    std::string buf;
+    put(buf, r.time_us);
+    put(buf, uint64_t(r.op));
+    put(buf, r.client);
+    put(buf, r.flags);
+    put_list(buf, r.fhs, [&](int fh) { put_int(buf, fh); });
+    put_list(buf, r.results, [&](int fh) { put_int(buf, fh); });
+    put_list(buf, r.paths, [&](const std::string &p) { put_str(buf, p); });
+    put_list(buf, r.sizes, [&](uint64_t size) { put(buf, size); });
+    put_list(buf, r.guards, [&](const TxnGuard &g) {
+      put(buf, uint64_t(g.type));
+      put_int(buf, g.fh);
+      put_str(buf, g.path);
+      put_int(buf, g.value);
+    });
+    put_list(buf, r.ops, [&](const TxnOp &op) {
+      put(buf, uint64_t(op.type));
+      put_int(buf, op.fh);
+      put_str(buf, op.path);
+      put(buf, op.content.size());
+      put(buf, op.is_directory | op.is_ephemeral << 1);
+    });
+    std::lock_guard lg(mutex_);
+    out_.write(buf.data(), buf.size());
+  }
+
+ private:
+  explicit TraceWriter(const std::string &path)
+      : out_(path, std::ios::binary | std::ios::trunc),
+        start_(std::chrono::steady_clock::now()) {
+    if (!out_) throw std::runtime_error("Cannot write trace " + path);
+    out_.write(kTraceMagic, sizeof(kTraceMagic) - 1);
+  }
+
+  static void put(std::string &buf, uint64_t v) {
+    for (; v >= 0x80; v >>= 7) buf += char(v | 0x80);
+    buf += char(v);
+  }
+  // Zigzag, so that -1 takes one byte
+  static void put_int(std::string &buf, int64_t v) {
+    put(buf, (uint64_t(v) << 1) ^ uint64_t(v >> 63));
+  }
+  static void put_str(std::string &buf, const std::string &s) {
+    put(buf, s.size());
+    buf += s;
+  }
+  template <typename T, typename F>
+  static void put_list(std::string &buf, const std::vector<T> &list, F &&f) {
+    put(buf, list.size());
+    for (auto &e : list) f(e);
+  }
+
+  std::mutex mutex_;
+  std::ofstream out_;
+  uint32_t next_client_ = 0;
+  const std::chrono::steady_clock::time_point start_;
+};
+
+// Every record of a trace, in the order they were written. Asynchronous
+// calls are written when they complete, so times are not quite in order.
+inline std::vector<TraceRecord> read_trace(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  const std::string magic = kTraceMagic;
+  if (data.compare(0, magic.size(), magic) != 0) {
+    throw std::runtime_error(path + " is not a trace");
+  }
+  size_t pos = magic.size();
+  auto get = [&]() {
+    uint64_t v = 0;
+    for (int shift = 0;; shift += 7) {
+      if (pos >= data.size()) throw std::runtime_error("Truncated trace");
+      uint8_t byte = data[pos++];
+      v |= uint64_t(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) return v;
+    }
+  };
+  auto get_int = [&]() {
+    uint64_t v = get();
+    return int(int64_t(v >> 1) ^ -int64_t(v & 1));
+  };
+  auto get_str = [&]() {
+    auto size = get();
+    if (pos + size > data.size()) throw std::runtime_error("Truncated trace");
+    pos += size;
+    return data.substr(pos - size, size);
+  };
+  std::vector<TraceRecord> records;
+  while (pos < data.size()) {
+    auto &r = records.emplace_back();
+    r.time_us = get();
+    r.op = TraceOp(get());
+    r.client = get();
+    r.flags = get();
+    for (auto n = get(); n; --n) r.fhs.push_back(get_int());
+    for (auto n = get(); n; --n) r.results.push_back(get_int());
+    for (auto n = get(); n; --n) r.paths.push_back(get_str());
+    for (auto n = get(); n; --n) r.sizes.push_back(get());
+    for (auto n = get(); n; --n) {
+      auto &g = r.guards.emplace_back();
+      g.type = TxnGuard::Type(get());
+      g.fh = get_int();
+      g.path = get_str();
+      g.value = get_int();
+    }
+    for (auto n = get(); n; --n) {
+      auto &op = r.ops.emplace_back();
+      op.type = TxnOp::Type(get());
+      op.fh = get_int();
+      op.path = get_str();
+      op.content.assign(get(), 'x');
+      auto flags = get();
+      op.is_directory = flags & 1;
+      op.is_ephemeral = flags & 2;
+    }
+  }
+  return records;
+}
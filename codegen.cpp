@@ -39,33 +39,103 @@ class BaseType {
       : type_name(type_name), name(name), nuname(nuname) {}
 
   virtual std::string gen_decl() { return type_name + " " + name; }
-  virtual std::string gen_size() { return "sizeof(" + type_name + ")"; }
+  virtual std::string gen_size(const std::string& var) {
+    return "sizeof(" + type_name + ")";
+  }
+  virtual std::string gen_put(const std::string& var) {
+    return "bs.put_" + nuname + "(" + var + ");";
+  }
+  virtual std::string gen_get(const std::string& var) {
+    return var + " = bs.get_" + nuname + "();";
+  }
+  // Assign from the protobuf accessor expression `src`.
+  virtual std::string gen_from_proto(const std::string& var,
+                                     const std::string& src) {
+    return var + " = " + src + ";";
+  }
 
   std::string type_name, name, nuname;
 };
 
 class StringType : public BaseType {
   using BaseType::BaseType;
-  std::string gen_size() override {
-    return "sizeof(" + name + ".size()) + " + name + ".size()";
+  std::string gen_size(const std::string& var) override {
+    return "sizeof(" + var + ".size()) + " + var + ".size()";
+  }
+};
+
+// A nested message, serialized in place by its own generated put()/get().
+class MessageType : public BaseType {
+  using BaseType::BaseType;
+  std::string gen_size(const std::string& var) override {
+    return var + ".serialized_size()";
+  }
+  std::string gen_put(const std::string& var) override {
+    return var + ".put(bs);";
+  }
+  std::string gen_get(const std::string& var) override {
+    return var + ".get(bs);";
+  }
+  std::string gen_from_proto(const std::string& var,
+                             const std::string& src) override {
+    return var + " = " + type_name + "(&" + src + ");";
   }
 };
 
-std::unique_ptr<BaseType> factory(FieldDescriptor::Type type_enum,
-                                  std::string name) {
-  switch (type_enum) {
+// A repeated field, serialized as an i32 element count followed by elements.
+class RepeatedType : public BaseType {
+ public:
+  RepeatedType(std::unique_ptr<BaseType> elem, std::string name)
+      : BaseType("std::vector<" + elem->type_name + ">", name, ""),
+        elem(std::move(elem)) {}
+
+  std::string gen_size(const std::string& var) override {
+    return "[&] { size_t s = sizeof(int32_t); for (auto &e : " + var +
+           ") s += " + elem->gen_size("e") + "; return s; }()";
+  }
+  std::string gen_put(const std::string& var) override {
+    return "bs.put_i32(" + var + ".size()); for (auto &e : " + var + ") { " +
+           elem->gen_put("e") + " }";
+  }
+  std::string gen_get(const std::string& var) override {
+    return var + ".resize(bs.get_i32()); for (auto &e : " + var + ") { " +
+           elem->gen_get("e") + " }";
+  }
+  std::string gen_from_proto(const std::string& var,
+                             const std::string& src) override {
+    return var + ".clear(); for (auto &pe : " + src + ") { " +
+           elem->type_name + " e; " + elem->gen_from_proto("e", "pe") + " " +
+           var + ".push_back(std::move(e)); }";
+  }
+
+  std::unique_ptr<BaseType> elem;
+};
+
+std::unique_ptr<BaseType> scalar_factory(const FieldDescriptor* field) {
+  const std::string& name = field->name();
+  switch (field->type()) {
     case FieldDescriptor::TYPE_INT64:
       return std::make_unique<BaseType>("int64_t", name, "i64");
     case FieldDescriptor::TYPE_INT32:
       return std::make_unique<BaseType>("int32_t", name, "i32");
     case FieldDescriptor::TYPE_STRING:
       return std::make_unique<StringType>("std::string", name, "str");
+    case FieldDescriptor::TYPE_MESSAGE:
+      return std::make_unique<MessageType>(field->message_type()->name(),
+                                           name, "");
     default:
       std::cerr << "UNKNOWN TYPE" << std::endl;
       std::terminate();
   }
 }
 
+std::unique_ptr<BaseType> factory(const FieldDescriptor* field) {
+  if (field->is_repeated())
+    return std::make_unique<RepeatedType>(scalar_factory(field),
+                                          field->name());
+  return scalar_factory(field);
+}
+
 }  // namespace Type
 void gen_code(const std::string& action_name,
               std::vector<std::unique_ptr<Type::BaseType>>& fields) {
@@ -98,9 +168,9 @@ void gen_code(const std::string& action_name,
 
   puts("template <typename T>");
   printf("%s(const T* t) {\n", action_name.c_str());
-  for (int i = 0; i < fields.size(); i++) {
-    printf("%s = t->%s();\n", fields[i]->name.c_str(), fields[i]->name.c_str());
-  }
+  for (auto& f : fields)
+    std::cout << f->gen_from_proto(f->name, "t->" + f->name + "()")
+              << std::endl;
   puts("}");
   printf("%s(nuraft::buffer &data) {\n", action_name.c_str());
   puts("nuraft::buffer_serializer bs(data);");
@@ -108,29 +178,37 @@ void gen_code(const std::string& action_name,
     puts("auto action_num = bs.get_i8();");
     puts("assert(action_num == static_cast<int8_t>(action_name));");
   }
-  for (auto& f : fields)
-    printf("%s = bs.get_%s();\n", f->name.c_str(), f->nuname.c_str());
+  puts("get(bs);");
+  puts("}");
+
+  puts("size_t serialized_size() const {");
+  printf("return 0");
+  for (auto& f : fields) std::cout << '+' << f->gen_size(f->name);
+  puts(";}");
+
+  puts("void put(nuraft::buffer_serializer &bs) const {");
+  for (auto& f : fields) std::cout << f->gen_put(f->name) << std::endl;
+  puts("}");
+
+  puts("void get(nuraft::buffer_serializer &bs) {");
+  for (auto& f : fields) std::cout << f->gen_get(f->name) << std::endl;
   puts("}");
 
   puts("nuraft::ptr<nuraft::buffer> serialize() const {");
   if (is_action) {
     printf(
         "nuraft::ptr<nuraft::buffer> buf = "
-        "nuraft::buffer::alloc(sizeof(int8_t)");
+        "nuraft::buffer::alloc(sizeof(int8_t) + serialized_size());");
   } else {
-    printf("nuraft::ptr<nuraft::buffer> buf = nuraft::buffer::alloc(0");
-  }
-  for (int i = 0; i < fields.size(); i++) {
-    putchar('+');
-    std::cout << fields[i]->gen_size();
+    printf(
+        "nuraft::ptr<nuraft::buffer> buf = "
+        "nuraft::buffer::alloc(serialized_size());");
   }
-  puts(");");
   puts("nuraft::buffer_serializer bs(buf);");
   if (is_action) {
     puts("bs.put_u8(static_cast<uint8_t>(action_name));");
   }
-  for (auto& f : fields)
-    printf("bs.put_%s(%s);\n", f->nuname.c_str(), f->name.c_str());
+  puts("put(bs);");
   puts("return buf;");
   puts("}};\n");
 }
@@ -139,7 +217,8 @@ int main(int argc, char** argv) {
   std::cout << "#include <cstdint>\n"
                "#include <memory>\n"
                "#include <string>\n"
-               "#include <variant>\n\n"
+               "#include <variant>\n"
+               "#include <vector>\n\n"
 
                "#include \"libnuraft/buffer.hxx\"\n"
                "#include \"libnuraft/buffer_serializer.hxx\"\n"
@@ -176,7 +255,7 @@ int main(int argc, char** argv) {
     std::vector<std::unique_ptr<Type::BaseType>> fields;
     for (int j = 0; j < msg_type->field_count(); j++) {
       const auto& field = msg_type->field(j);
-      fields.push_back(Type::factory(field->type(), field->name()));
+      fields.push_back(Type::factory(field));
     }
     gen_code(msg_type->name(), fields);
   }
@@ -0,0 +1,37 @@
+// Coroutine demo: coroutines on a single thread take turns incrementing a
+// counter file under its exclusive lock
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../clientlib_coro.h"
+
+Task<> Increment(SkinnyClient &client, int times) {
+  int fh = co_await client.OpenAsync("/counter");
+  for (int i = 0; i < times; ++i) {
+    co_await client.AcquireAsync(fh, true);
+    std::string content = co_await client.GetContentAsync(fh);
+    int value = content.empty() ? 0 : std::stoi(content);
+    co_await client.SetContentAsync(fh, std::to_string(value + 1));
+    co_await client.ReleaseAsync(fh);
+  }
+  co_await client.CloseAsync(fh);
+}
+
+int main() {
+  const int num_workers = 4, times = 10;
+  // Locks are held by sessions, so each worker has its own client
+  std::vector<std::unique_ptr<SkinnyClient>> clients;
+  CoExecutor executor;
+  for (int i = 0; i < num_workers; ++i) {
+    clients.push_back(std::make_unique<SkinnyClient>());
+    executor.Spawn(Increment(*clients.back(), times));
+  }
+  executor.Wait();
+
+  SkinnyClient a;
+  int fh = a.Open("/counter");
+  std::cout << "counter = " << a.GetContent(fh) << std::endl;
+}
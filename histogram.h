@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Latency histogram with log-linear buckets, as in HdrHistogram: 32 buckets
+// per power of two, so a reported value is within ~3% of the recorded one.
+// Values are in nanoseconds, up to ~18 minutes. Not thread-safe; keep one per
+// thread and merge() them, or use SharedHistogram.
+class Histogram {
+ public:
+  static constexpr int kSubBits = 5;
+  static constexpr int kMaxBits = 40;
+  static constexpr int kBuckets = (kMaxBits - kSubBits + 1) << kSubBits;
+
+  void record(uint64_t ns) {
+    ++counts_[index(ns)];
+    ++count_;
+    max_ = std::max(max_, ns);
+  }
+  void record(std::chrono::nanoseconds d) { record(d.count()); }
+  void merge(const Histogram &other) {
+    for (int i = 0; i < kBuckets; ++i) counts_[i] += other.counts_[i];
+    count_ += other.count_;
+    max_ = std::max(max_, other.max_);
+  }
+  void add(int bucket, uint64_t n) {
+    counts_[bucket] += n;
+    count_ += n;
+    if (n) max_ = std::max(max_, upper(bucket));
+  }
+
+  uint64_t count() const { return count_; }
+  uint64_t max() const { return max_; }
+  // The value below which `percent` of the recorded values fall
+  uint64_t percentile(double percent) const {
+    if (count_ == 0) return 0;
+    auto rank = std::max<uint64_t>(1, uint64_t(count_ * percent / 100 + 0.5));
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+      seen += counts_[i];
+      if (seen >= rank) return std::min(upper(i), max_);
+    }
+    return max_;
+  }
+
+  // {"count":N,"p50":..,"p99":..,"p999":..,"max":..}, in microseconds
+  std::string json() const {
+    auto us = [](uint64_t ns) {
+      char buf[32];
+      std::snprintf(buf, sizeof(buf), "%.3f", ns / 1000.0);
+      return std::string(buf);
+    };
+    return "{\"count\":" + std::to_string(count_) +
+           ",\"p50\":" + us(percentile(50)) + ",\"p99\":" + us(percentile(99)) +
+           ",\"p999\":" + us(percentile(99.9)) + ",\"max\":" + us(max_) + "}";
+  }
+
+  static int index(uint64_t ns) {
+    ns = std::min(ns, (uint64_t{1} << kMaxBits) - 1);
+    if (ns < (1 << kSubBits)) return ns;
+    int shift = std::bit_width(ns) - 1 - kSubBits;
+    return ((shift + 1) << kSubBits) + (ns >> shift) - (1 << kSubBits);
+  }
+  // Largest value in bucket `i`
+  static uint64_t upper(int i) {
+    if (i < (1 << kSubBits)) return i;
+    int shift = (i >> kSubBits) - 1;
+    uint64_t low = uint64_t((i & ((1 << kSubBits) - 1)) + (1 << kSubBits))
+                   << shift;
+    return low + (uint64_t{1} << shift) - 1;
+  }
+
+ private:
+  std::array<uint64_t, kBuckets> counts_{};
+  uint64_t count_ = 0;
+  uint64_t max_ = 0;
+};
+
+// Small index of the calling thread, for striping counters across threads
+inline int thread_stripe() {
+  static std::atomic<int> next{0};
+  thread_local int stripe = next.fetch_add(1, std::memory_order_relaxed);
+  return stripe;
+}
+
+// A Histogram recorded from many threads. Each thread writes its own stripe
+// of relaxed atomic counters, so recording takes no lock and rarely shares a
+// cache line; snapshot() adds the stripes up.
+class SharedHistogram {
+ public:
+  void record(uint64_t ns) {
+    auto &stripe = stripes_[thread_stripe() % kStripes];
+    stripe.counts[Histogram::index(ns)].fetch_add(1, std::memory_order_relaxed);
+  }
+  void record(std::chrono::nanoseconds d) { record(d.count()); }
+
+  Histogram snapshot() const {
+    Histogram h;
+    for (auto &stripe : stripes_) {
+      for (int i = 0; i < Histogram::kBuckets; ++i) {
+        h.add(i, stripe.counts[i].load(std::memory_order_relaxed));
+      }
+    }
+    return h;
+  }
+
+ private:
+  static constexpr int kStripes = 16;
+  struct alignas(64) Stripe {
+    std::array<std::atomic<uint64_t>, Histogram::kBuckets> counts{};
+  };
+  std::array<Stripe, kStripes> stripes_;
+};
+
+// Records the time from construction to destruction into `h`
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(SharedHistogram &h)
+      : h_(h), start_(std::chrono::steady_clock::now()) {}
+  ~ScopedTimer() { h_.record(std::chrono::steady_clock::now() - start_); }
+
+ private:
+  SharedHistogram &h_;
+  std::chrono::steady_clock::time_point start_;
+};
@@ -0,0 +1,82 @@
+# Compares keeping many calls in flight from one Python process with the
+# awaitable calls of pyclientlib (one event loop thread) and with threads
+# making blocking calls, as the tests in test/ do:
+#   SKINNY_CONFIG=<cluster config> python3 bench_asyncio.py [get|set] [in_flight] [seconds]
+# Prints ops/s and latency percentiles of each, one line per mode.
+import asyncio
+import os
+import sys
+import threading
+import time
+
+sys.path.append(os.path.realpath(os.path.join(os.path.dirname(os.path.realpath(__file__)), "..", "build")))
+from pyclientlib import SkinnyClient
+
+
+def percentile(latencies, p):
+    latencies.sort()
+    return latencies[min(len(latencies) - 1, int(len(latencies) * p))] * 1e3
+
+
+def report(mode, latencies, seconds):
+    print(f"{mode:8} {len(latencies) / seconds:10.0f} ops/s"
+          f"  p50 {percentile(latencies, 0.5):7.2f} ms"
+          f"  p99 {percentile(latencies, 0.99):7.2f} ms", flush=True)
+
+
+def setup(client, in_flight):
+    client.OpenDir("/bench_asyncio")
+    fhs = client.OpenMany([f"/bench_asyncio/{i}" for i in range(in_flight)])
+    for fh in fhs:
+        client.SetContent(fh, b"x" * 100)
+    return fhs
+
+
+async def run_asyncio(op, in_flight, seconds):
+    client = SkinnyClient()
+    fhs = setup(client, in_flight)
+    latencies = []
+    end = time.monotonic() + seconds
+
+    async def worker(fh):
+        while time.monotonic() < end:
+            start = time.monotonic()
+            if op == "get":
+                await client.GetContentAsync(fh)
+            else:
+                await client.SetContentAsync(fh, b"y" * 100)
+            latencies.append(time.monotonic() - start)
+
+    await asyncio.gather(*(worker(fh) for fh in fhs))
+    report("asyncio", latencies, seconds)
+
+
+def run_threads(op, in_flight, seconds):
+    client = SkinnyClient()
+    fhs = setup(client, in_flight)
+    latencies = []
+    end = time.monotonic() + seconds
+
+    def worker(fh):
+        while time.monotonic() < end:
+            start = time.monotonic()
+            if op == "get":
+                client.GetContent(fh)
+            else:
+                client.SetContent(fh, b"y" * 100)
+            latencies.append(time.monotonic() - start)
+
+    threads = [threading.Thread(target=worker, args=[fh]) for fh in fhs]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    report("threads", latencies, seconds)
+
+
+if __name__ == "__main__":
+    op = sys.argv[1] if len(sys.argv) > 1 else "set"
+    in_flight = int(sys.argv[2]) if len(sys.argv) > 2 else 1000
+    seconds = float(sys.argv[3]) if len(sys.argv) > 3 else 10
+    asyncio.run(run_asyncio(op, in_flight, seconds))
+    run_threads(op, in_flight, seconds)
@@ -0,0 +1,75 @@
+// Delivers bursts of events to callbacks, as the client library does with
+// the events of an invalidation storm, and prints the latency from an
+// event's arrival to the start of its callback, with a thread started per
+// event (as the client library used to) and with CallbackExecutor:
+//   bench_callbacks [bursts] [events per burst] [handles] [callback us]
+// No cluster is needed.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../clientlib_executor.h"
+#include "../histogram.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Posts `bursts` bursts of `events` events, 10ms apart, spread over
+// `handles` handles. Each callback busy-waits `work` to stand for the
+// application's handling of an invalidation.
+void run(const char *name, int bursts, int events, int handles,
+         std::chrono::microseconds work,
+         const std::function<void(int, std::function<void()>)> &post,
+         const std::function<void()> &drain) {
+  SharedHistogram latency;
+  std::atomic<int> done{0};
+  auto start = Clock::now();
+  for (int b = 0; b < bursts; ++b) {
+    std::this_thread::sleep_until(start + std::chrono::milliseconds(10) * b);
+    for (int e = 0; e < events; ++e) {
+      auto posted = Clock::now();
+      post(e % handles, [&latency, &done, posted, work] {
+        auto started = Clock::now();
+        latency.record(started - posted);
+        while (Clock::now() - started < work) {
+        }
+        done.fetch_add(1, std::memory_order_release);
+      });
+    }
+  }
+  drain();
+  while (done.load(std::memory_order_acquire) < bursts * events) {
+    std::this_thread::yield();
+  }
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  std::printf("%-22s %8.0f events/s  latency_us %s\n", name,
+              bursts * events / elapsed.count(),
+              latency.snapshot().json().c_str());
+}
+
+int main(int argc, char **argv) {
+  const int bursts = argc > 1 ? std::stoi(argv[1]) : 100;
+  const int events = argc > 2 ? std::stoi(argv[2]) : 1000;
+  const int handles = argc > 3 ? std::stoi(argv[3]) : 100;
+  const std::chrono::microseconds work(argc > 4 ? std::stoi(argv[4]) : 20);
+
+  run("thread_per_event", bursts, events, handles, work,
+      [](int, std::function<void()> task) {
+        std::thread(std::move(task)).detach();
+      },
+      [] {});
+  for (int threads : {1, 4, 16}) {
+    std::optional<CallbackExecutor> executor(std::in_place, threads, 1 << 16);
+    auto name = "executor_" + std::to_string(threads) + "_threads";
+    run(name.c_str(), bursts, events, handles, work,
+        [&executor](int fh, std::function<void()> task) {
+          executor->post(fh, std::move(task));
+        },
+        [&executor] { executor.reset(); });
+  }
+  return 0;
+}
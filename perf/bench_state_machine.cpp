@@ -0,0 +1,167 @@
+// Drives StateMachine::commit() in process, with no Raft, gRPC or network,
+// and prints ops/s, heap allocations per op and cycles per op of each kind
+// of log entry:
+//   bench_state_machine [ops per benchmark]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../StateMachine.cpp"
+
+// Every operator new is counted, so a benchmark can report the allocations
+// its commits made.
+static std::atomic<uint64_t> allocations{0};
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size ? size : 1);
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+// Time stamp counter ticks, at the nominal clock rate on modern x86. Zero
+// elsewhere, where cycles/op is not reported.
+static uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+class Bench {
+ public:
+  Bench()
+      : ds_(std::make_shared<DataStore>()),
+        sdb_(std::make_shared<session::Db>([](int) {})),
+        sm_(ds_, sdb_) {
+    ds_->operator[]("/");
+    ds_->at("/").first.file_exists = true;
+    ds_->at("/").first.is_directory = true;
+  }
+
+  // Commits an entry outside of any measurement
+  template <typename Action>
+  nuraft::ptr<nuraft::buffer> commit(const Action &action) {
+    return sm_.commit(++log_idx_, *action.serialize());
+  }
+
+  int start_session() {
+    return action::StartSessionReturn(*commit(action::StartSessionAction()))
+        .session_id;
+  }
+
+  int open(int session_id, const std::string &path, bool is_directory = false,
+           bool is_ephemeral = false) {
+    action::OpenAction action(session_id, path, is_directory, is_ephemeral);
+    return action::OpenReturn(*commit(action)).fh;
+  }
+
+  // Commits `ops` entries, cycling through `entries`, and prints a line.
+  // Entries are serialized up front, so only commit() is measured. Output
+  // of the state machine is muted meanwhile.
+  void run(const char *name,
+           const std::vector<nuraft::ptr<nuraft::buffer>> &entries,
+           size_t ops) {
+    std::cout.setstate(std::ios::badbit);
+    auto allocs = allocations.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    auto start_cycles = cycles();
+    for (size_t i = 0; i < ops; ++i) {
+      sm_.commit(++log_idx_, *entries[i % entries.size()]);
+    }
+    auto elapsed_cycles = cycles() - start_cycles;
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    allocs = allocations.load(std::memory_order_relaxed) - allocs;
+    std::cout.clear();
+    std::printf("%-20s %8zu ops %12.0f ops/s %8.2f allocs/op", name, ops,
+                ops / elapsed.count(), double(allocs) / ops);
+    if (elapsed_cycles) {
+      std::printf(" %10.0f cycles/op", double(elapsed_cycles) / ops);
+    }
+    std::printf("\n");
+  }
+
+ private:
+  std::shared_ptr<DataStore> ds_;
+  std::shared_ptr<session::Db> sdb_;
+  StateMachine::StateMachine sm_;
+  uint64_t log_idx_ = 0;
+};
+
+template <typename Action>
+std::vector<nuraft::ptr<nuraft::buffer>> serialize_all(
+    const std::vector<Action> &actions) {
+  std::vector<nuraft::ptr<nuraft::buffer>> entries;
+  for (auto &action : actions) entries.push_back(action.serialize());
+  return entries;
+}
+
+int main(int argc, char **argv) {
+  const size_t ops = argc > 1 ? std::stoul(argv[1]) : 100000;
+  const int num_files = 1000;
+  const int num_sessions = 10000;
+  const int files_per_session = 4;
+  Bench bench;
+  int sid = bench.start_session();
+  bench.open(sid, "/bench", true);
+
+  std::vector<action::OpenAction> opens;
+  for (int i = 0; i < num_files; ++i) {
+    opens.emplace_back(sid, "/bench/" + std::to_string(i), 0, 0);
+  }
+  // The first num_files opens create the files, later ones open them again.
+  // Each open takes a handle slot of the session, hence the cap.
+  bench.run("open", serialize_all(opens), std::min<size_t>(ops, 1 << 19));
+  std::vector<int> fhs;
+  for (int i = 0; i < num_files; ++i) {
+    fhs.push_back(bench.open(sid, "/bench/" + std::to_string(i)));
+  }
+
+  for (size_t size : {16, 1024, 65536}) {
+    std::vector<action::SetContentAction> sets;
+    for (int fh : fhs) sets.emplace_back(sid, fh, std::string(size, 'x'));
+    auto name = "set_content_" + std::to_string(size);
+    bench.run(name.c_str(), serialize_all(sets), ops);
+  }
+
+  std::vector<nuraft::ptr<nuraft::buffer>> acq_rel;
+  for (int fh : fhs) {
+    acq_rel.push_back(action::AcqAction(sid, fh, 1).serialize());
+    acq_rel.push_back(action::RelAction(sid, fh).serialize());
+  }
+  bench.run("acq_rel", acq_rel, ops / 2 * 2);
+
+  std::vector<action::DeleteAction> deletes;
+  for (int fh : fhs) deletes.emplace_back(sid, fh);
+  bench.run("delete", serialize_all(deletes), deletes.size());
+
+  std::vector<action::EndSessionAction> ends;
+  for (int i = 0; i < num_sessions; ++i) {
+    int session_id = bench.start_session();
+    for (int j = 0; j < files_per_session; ++j) {
+      auto path = "/bench/s" + std::to_string(i) + "_" + std::to_string(j);
+      bench.open(session_id, path, false, j % 2);
+    }
+    ends.emplace_back(session_id);
+  }
+  bench.run("end_session", serialize_all(ends), ends.size());
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../clientlib_coro.h"
+
+const int num_file = 10;
+const std::string dirname = "/coro_bench";
+const std::string filename_prefix = "/file";
+
+using Clock = std::chrono::steady_clock;
+
+// Each worker keeps one request in flight: a write with probability
+// write_ratio, else a read.
+void ThreadWorker(SkinnyClient &sc, const std::vector<int> &fh,
+                  Clock::time_point deadline, float write_ratio,
+                  std::atomic<int> &ops) {
+  std::mt19937 gen(std::random_device{}());
+  std::uniform_real_distribution<> write_lottery(0.0, 1.0);
+  std::uniform_int_distribution<> file_lottery(0, num_file - 1);
+  while (Clock::now() <= deadline) {
+    double res = write_lottery(gen);
+    if (res < write_ratio) {
+      sc.SetContent(fh[file_lottery(gen)], "garbage" + std::to_string(res));
+    } else {
+      sc.GetContent(fh[file_lottery(gen)]);
+    }
+    ++ops;
+  }
+}
+
+Task<> CoroWorker(SkinnyClient &sc, const std::vector<int> &fh,
+                  Clock::time_point deadline, float write_ratio,
+                  std::atomic<int> &ops) {
+  std::mt19937 gen(std::random_device{}());
+  std::uniform_real_distribution<> write_lottery(0.0, 1.0);
+  std::uniform_int_distribution<> file_lottery(0, num_file - 1);
+  while (Clock::now() <= deadline) {
+    double res = write_lottery(gen);
+    if (res < write_ratio) {
+      co_await sc.SetContentAsync(fh[file_lottery(gen)],
+                                  "garbage" + std::to_string(res));
+    } else {
+      co_await sc.GetContentAsync(fh[file_lottery(gen)]);
+    }
+    ++ops;
+  }
+}
+
+int main(int argc, char **argv) {
+  // Compares a thread per outstanding request (as in perf_client) with the
+  // same number of coroutines on one thread, both over one session.
+  if (argc != 4) {
+    std::cerr << "usage: " << argv[0] << " concurrency duration write_ratio"
+              << std::endl;
+    exit(1);
+  }
+  const int concurrency = std::stoi(std::string(argv[1]));
+  const int duration = std::stoi(std::string(argv[2]));
+  const float write_ratio = std::stof(std::string(argv[3]));
+
+  SkinnyClient sc;
+  int dirfh = sc.OpenDir(dirname);
+  std::vector<std::string> paths;
+  for (int i = 0; i < num_file; ++i)
+    paths.push_back(dirname + filename_prefix + std::to_string(i));
+  std::vector<int> fh = sc.OpenMany(paths);
+
+  std::atomic<int> thread_ops = 0;
+  {
+    auto deadline = Clock::now() + std::chrono::seconds(duration);
+    std::vector<std::thread> vt;
+    for (int i = 0; i < concurrency; ++i) {
+      vt.emplace_back(ThreadWorker, std::ref(sc), std::cref(fh), deadline,
+                      write_ratio, std::ref(thread_ops));
+    }
+    for (auto &t : vt) t.join();
+  }
+
+  std::atomic<int> coro_ops = 0;
+  {
+    auto deadline = Clock::now() + std::chrono::seconds(duration);
+    CoExecutor executor;
+    for (int i = 0; i < concurrency; ++i) {
+      executor.Spawn(CoroWorker(sc, fh, deadline, write_ratio, coro_ops));
+    }
+    executor.Wait();
+  }
+
+  sc.CloseMany(fh);
+  sc.Close(dirfh);
+
+  std::cout << "thread_ops=" << thread_ops << ", coro_ops=" << coro_ops
+            << ", thread_ops_per_sec=" << thread_ops / duration
+            << ", coro_ops_per_sec=" << coro_ops / duration << std::endl;
+  return 0;
+}
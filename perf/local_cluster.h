@@ -0,0 +1,84 @@
+#pragma once
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../clientlib.h"
+#include "../clientlib_diagnostic.h"
+
+// Servers of a cluster run as child processes on this machine, on loopback
+// ports, for benchmarks that need no other nodes. The client library reads
+// its cluster config at load time, so the caller points $SKINNY_CONFIG at
+// config_path() before starting (see perf_client's local mode).
+class LocalCluster {
+ public:
+  // Node i listens on base_port + 10 * i for Raft, and the next port for
+  // gRPC, as in test/cluster.conf.
+  static std::string config_path(int base_port) {
+    return "/tmp/skinny_bench_" + std::to_string(base_port) + ".conf";
+  }
+  static void write_config(int servers, int base_port) {
+    std::ofstream out(config_path(base_port));
+    for (int i = 0; i < servers; ++i) {
+      out << i << " 127.0.0.1 " << base_port + 10 * i << "\n";
+    }
+    if (!out) throw std::runtime_error("Cannot write cluster config");
+  }
+
+  // Starts `servers` servers and waits until they all joined the cluster.
+  // Their output goes to /tmp/skinny_bench_<base port>_<id>.log.
+  LocalCluster(const std::string &server_binary, int servers, int base_port) {
+    const auto config = config_path(base_port);
+    for (int i = 0; i < servers; ++i) {
+      const auto log = "/tmp/skinny_bench_" + std::to_string(base_port) + "_" +
+                       std::to_string(i) + ".log";
+      pid_t pid = fork();
+      if (pid == 0) {
+        freopen(log.c_str(), "w", stdout);
+        execl(server_binary.c_str(), server_binary.c_str(),
+              std::to_string(i).c_str(), "--config", config.c_str(), nullptr);
+        perror(server_binary.c_str());
+        _exit(1);
+      }
+      pids_.push_back(pid);
+    }
+    if (!wait_for_members(servers)) {
+      stop();
+      throw std::runtime_error("Local cluster did not come up");
+    }
+  }
+
+  ~LocalCluster() { stop(); }
+
+ private:
+  bool wait_for_members(int servers) {
+    SkinnyDiagnosticClient diagnostic;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    while (std::chrono::steady_clock::now() < deadline) {
+      try {
+        if (diagnostic.GetMembers().size() == servers) return true;
+      } catch (const SkinnyError &) {
+        // no leader yet
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return false;
+  }
+
+  void stop() {
+    for (pid_t pid : pids_) kill(pid, SIGTERM);
+    for (pid_t pid : pids_) waitpid(pid, nullptr, 0);
+    pids_.clear();
+  }
+
+  std::vector<pid_t> pids_;
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "../clientlib.h"
+#include "../histogram.h"
+
+struct LoadResult {
+  Histogram latency;  // of the ops due after the warmup
+  uint64_t ops = 0;
+  uint64_t errors = 0;  // ops that raised a SkinnyError
+  double seconds = 0;   // from the end of the warmup to the last op's end
+};
+
+// Runs op(thread, i) for i = 0, 1, ... on `threads` threads, op i being due
+// at start + i / rate. Its latency is measured from when it was due, not
+// from when a thread got to it, so a stall shows up in the latency of
+// every op queued behind it instead of being hidden by the ops that were
+// never sent meanwhile (coordinated omission). Ops due within `warmup` run
+// but are not recorded.
+inline LoadResult run_open_loop(
+    int threads, double rate, std::chrono::nanoseconds warmup,
+    std::chrono::nanoseconds duration,
+    const std::function<void(int thread, uint64_t i)> &op) {
+  using Clock = std::chrono::steady_clock;
+  const auto start = Clock::now() + std::chrono::milliseconds(100);
+  const auto measured = start + warmup;
+  const auto end = measured + duration;
+  const std::chrono::duration<double> period(1 / rate);
+  std::atomic<uint64_t> next{0};
+  std::vector<LoadResult> results(threads);
+  std::vector<Clock::time_point> finished(threads, measured);
+  std::vector<std::thread> vt;
+  for (int t = 0; t < threads; ++t) {
+    vt.emplace_back([&, t] {
+      while (true) {
+        uint64_t i = next.fetch_add(1, std::memory_order_relaxed);
+        auto due = start + std::chrono::duration_cast<Clock::duration>(
+                               period * double(i));
+        if (due >= end) return;
+        std::this_thread::sleep_until(due);
+        bool ok = true;
+        try {
+          op(t, i);
+        } catch (const SkinnyError &) {
+          ok = false;
+        }
+        if (due < measured) continue;
+        auto now = Clock::now();
+        results[t].latency.record(now - due);
+        ++results[t].ops;
+        if (!ok) ++results[t].errors;
+        finished[t] = now;
+      }
+    });
+  }
+  for (auto &t : vt) t.join();
+  LoadResult sum;
+  auto last = measured;
+  for (int t = 0; t < threads; ++t) {
+    sum.latency.merge(results[t].latency);
+    sum.ops += results[t].ops;
+    sum.errors += results[t].errors;
+    last = std::max(last, finished[t]);
+  }
+  sum.seconds = std::chrono::duration<double>(last - measured).count();
+  return sum;
+}
+
+// Runs op(thread, i) back to back on each of `threads` threads, a thread
+// pausing think(thread) between its ops, for `duration` after `warmup`.
+// Latency is measured from the start of each op; a closed loop sends
+// fewer ops while the servers stall, so it hides their tail latency.
+inline LoadResult run_closed_loop(
+    int threads, std::chrono::nanoseconds warmup,
+    std::chrono::nanoseconds duration,
+    const std::function<void(int thread, uint64_t i)> &op,
+    const std::function<std::chrono::microseconds(int thread)> &think) {
+  using Clock = std::chrono::steady_clock;
+  const auto measured = Clock::now() + warmup;
+  const auto end = measured + duration;
+  std::atomic<uint64_t> next{0};
+  std::vector<LoadResult> results(threads);
+  std::vector<std::thread> vt;
+  for (int t = 0; t < threads; ++t) {
+    vt.emplace_back([&, t] {
+      for (auto now = Clock::now(); now < end; now = Clock::now()) {
+        bool ok = true;
+        try {
+          op(t, next.fetch_add(1, std::memory_order_relaxed));
+        } catch (const SkinnyError &) {
+          ok = false;
+        }
+        if (now >= measured) {
+          results[t].latency.record(Clock::now() - now);
+          ++results[t].ops;
+          if (!ok) ++results[t].errors;
+        }
+        std::this_thread::sleep_for(think(t));
+      }
+    });
+  }
+  for (auto &t : vt) t.join();
+  LoadResult sum;
+  for (auto &r : results) {
+    sum.latency.merge(r.latency);
+    sum.ops += r.ops;
+    sum.errors += r.errors;
+  }
+  sum.seconds = std::chrono::duration<double>(Clock::now() - measured).count();
+  return sum;
+}
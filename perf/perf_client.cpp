@@ -1,13 +1,23 @@
 #include <condition_variable>
+#include <cstdlib>
 #include <cstring>
+#include <filesystem>
+#include <functional>
 #include <iostream>
 #include <latch>
+#include <memory>
 #include <mutex>
 #include <random>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "../clientlib.h"
+#include "../histogram.h"
+#include "local_cluster.h"
+#include "open_loop.h"
+#include "workload.h"
 using namespace std::chrono_literals;
 
 const int num_file = 10;
@@ -15,12 +25,150 @@ const std::string dirname = "/perf";
 const std::string clientdir = dirname + "/client";
 const std::string filename_prefix = "/file";
 
+// Sets up one client per thread for `workload`, and returns its op
+std::function<void(int, uint64_t)> make_workload(
+    const std::string& workload, int thd_cnt, float write_ratio, int watchers,
+    std::vector<std::unique_ptr<SkinnyClient>>& clients) {
+  for (int i = 0; i < thd_cnt; ++i) {
+    clients.push_back(std::make_unique<SkinnyClient>());
+  }
+  if (workload == "readwrite") {
+    // Reads and writes of num_file files, mostly served from the cache
+    auto fhs = std::make_shared<std::vector<std::vector<int>>>();
+    std::vector<std::string> paths;
+    for (int i = 0; i < num_file; ++i)
+      paths.push_back(dirname + filename_prefix + std::to_string(i));
+    for (auto& sc : clients) fhs->push_back(sc->OpenMany(paths));
+    return [&clients, fhs, write_ratio](int t, uint64_t i) {
+      // Seeded by the op, so every run does the same ops
+      std::mt19937 gen(i);
+      std::uniform_real_distribution<> write_lottery(0.0, 1.0);
+      int fh = (*fhs)[t][gen() % num_file];
+      if (write_lottery(gen) < write_ratio) {
+        clients[t]->SetContent(fh, "garbage" + std::to_string(i));
+      } else {
+        clients[t]->GetContent(fh);
+      }
+    };
+  } else if (workload == "lock") {
+    // Every thread takes and releases the same exclusive lock
+    auto fhs = std::make_shared<std::vector<int>>();
+    for (auto& sc : clients) fhs->push_back(sc->Open(dirname + "/lock"));
+    return [&clients, fhs](int t, uint64_t) {
+      clients[t]->Acquire((*fhs)[t], true);
+      clients[t]->Release((*fhs)[t]);
+    };
+  } else if (workload == "watch") {
+    // Writes to a file that `watchers` other sessions have open, so each
+    // write waits for all of them to ack its invalidation
+    const auto path = dirname + "/watched";
+    auto watching = std::make_shared<std::vector<SkinnyClient>>(watchers);
+    for (auto& sc : *watching) sc.GetContent(sc.Open(path));
+    auto fhs = std::make_shared<std::vector<int>>();
+    for (auto& sc : clients) fhs->push_back(sc->Open(path));
+    return [&clients, fhs, watching](int t, uint64_t i) {
+      clients[t]->SetContent((*fhs)[t], "garbage" + std::to_string(i));
+    };
+  } else if (workload == "churn") {
+    // A session per op: start it, create an ephemeral file, end it
+    return [](int, uint64_t i) {
+      SkinnyClient sc;
+      sc.Open(dirname + "/churn" + std::to_string(i), std::nullopt, true);
+    };
+  }
+  throw std::invalid_argument("Unknown workload " + workload);
+}
+
+// perf_client local <servers> <workload> <rate> <duration> [threads=32]
+//     [write_ratio=0.1] [watchers=100] [base_port=20000] [server=<path>]
+// Starts a cluster of `servers` on this machine and runs `workload`
+// (readwrite, lock, watch, churn, or a workload file, see workload.h)
+// open-loop at `rate` ops/s for `duration` seconds after a 1s warmup. A
+// rate of 0 runs it closed-loop instead, with the file's think time.
+// Prints one JSON object.
+int local_main(int argc, char** argv) {
+  if (argc < 6) {
+    std::cerr << "usage: " << argv[0]
+              << " local servers workload rate duration [threads=N]"
+                 " [write_ratio=R] [watchers=N] [base_port=P] [server=PATH]"
+              << std::endl;
+    return 1;
+  }
+  const int servers = std::stoi(argv[2]);
+  const std::string workload = argv[3];
+  const double rate = std::stod(argv[4]);
+  const int duration = std::stoi(argv[5]);
+  int thd_cnt = 32, watchers = 100, base_port = 20000;
+  float write_ratio = 0.1;
+  auto server = std::filesystem::read_symlink("/proc/self/exe")
+                    .parent_path()
+                    .append("server")
+                    .string();
+  for (int i = 6; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto eq = arg.find('=');
+    auto name = arg.substr(0, eq), value = arg.substr(eq + 1);
+    if (name == "threads") {
+      thd_cnt = std::stoi(value);
+    } else if (name == "write_ratio") {
+      write_ratio = std::stof(value);
+    } else if (name == "watchers") {
+      watchers = std::stoi(value);
+    } else if (name == "base_port") {
+      base_port = std::stoi(value);
+    } else if (name == "server") {
+      server = value;
+    }
+  }
+  // The client library reads $SKINNY_CONFIG when it is loaded, so point it
+  // at the local cluster and start over.
+  const auto config = LocalCluster::config_path(base_port);
+  if (const char* env = std::getenv("SKINNY_CONFIG"); !env || env != config) {
+    LocalCluster::write_config(servers, base_port);
+    setenv("SKINNY_CONFIG", config.c_str(), 1);
+    execv("/proc/self/exe", argv);
+    perror("execv");
+    return 1;
+  }
+
+  LocalCluster cluster(server, servers, base_port);
+  SkinnyClient().OpenDir(dirname);
+  std::vector<std::unique_ptr<SkinnyClient>> clients;
+  std::unique_ptr<SpecWorkload> spec;
+  std::function<void(int, uint64_t)> op;
+  std::function<std::chrono::microseconds(int)> think = [](int) { return 0us; };
+  if (std::filesystem::exists(workload)) {
+    spec = std::make_unique<SpecWorkload>(load_workload_spec(workload),
+                                          dirname, thd_cnt);
+    op = std::ref(*spec);
+    think = [&spec](int t) { return spec->think_time(t); };
+  } else {
+    op = make_workload(workload, thd_cnt, write_ratio, watchers, clients);
+  }
+  auto result =
+      rate > 0
+          ? run_open_loop(thd_cnt, rate, 1s, std::chrono::seconds(duration), op)
+          : run_closed_loop(thd_cnt, 1s, std::chrono::seconds(duration), op,
+                            think);
+  std::cout << "{\"workload\":\"" << workload << "\",\"servers\":" << servers
+            << ",\"threads\":" << thd_cnt << ",\"rate\":" << rate
+            << ",\"ops\":" << result.ops << ",\"errors\":" << result.errors
+            << ",\"achieved_rate\":" << result.ops / result.seconds
+            << ",\"latency_us\":" << result.latency.json() << "}" << std::endl;
+  return 0;
+}
+
 int main(int argc, char** argv) {
+  if (argc > 1 && std::string(argv[1]) == "local") {
+    return local_main(argc, argv);
+  }
   // in: #threads, duration, write_ratio, ---start_time---
   // out: #ops (read/write) to server, #ops in cache
-  if (argc != 6) {
+  if (argc < 6) {
     std::cerr << "usage: " << argv[0]
-              << " node_num node_cnt thd_cnt duration write_ratio" << std::endl;
+              << " node_num node_cnt thd_cnt duration write_ratio"
+                 " [shared] [observer] [nocache] [json]"
+              << std::endl;
     exit(1);
   }
   const int node_num = std::stoi(std::string(argv[1]));
@@ -28,8 +176,28 @@ int main(int argc, char** argv) {
   const int thd_cnt = std::stoi(std::string(argv[3]));
   const int duration = std::stoi(std::string(argv[4]));
   const float write_ratio = std::stof(std::string(argv[5]));
+  SkinnyClientOptions options;
+  bool json = false;
+  for (int i = 6; i < argc; ++i) {
+    std::string flag = argv[i];
+    if (flag == "shared") {
+      // threads share one session and cache instead of one each
+      options.shared_connection = true;
+    } else if (flag == "observer") {
+      // each client reads from a random observer in the cluster config
+      options.read_from_observer = true;
+    } else if (flag == "nocache") {
+      // every read goes to a server
+      options.cache_bytes = 0;
+    } else if (flag == "json") {
+      // print the counts and latency percentiles as one JSON object
+      json = true;
+    }
+  }
 
   int read_ops[thd_cnt], write_ops[thd_cnt];
+  CacheStats cache_stats[thd_cnt];
+  std::vector<Histogram> read_lat(thd_cnt), write_lat(thd_cnt);
   int sum_read_ops = 0, sum_write_ops = 0;
   memset(read_ops, 0, sizeof(int) * thd_cnt);
   memset(write_ops, 0, sizeof(int) * thd_cnt);
@@ -40,24 +208,29 @@ int main(int argc, char** argv) {
     std::mt19937 gen(rd());
     std::uniform_real_distribution<> write_lottery(0.0, 1.0);
     std::uniform_int_distribution<> file_lottery(0, num_file - 1);
-    SkinnyClient sc;
-    int fh[num_file];
+    SkinnyClient sc(options);
+    std::vector<std::string> paths;
     for (int i = 0; i < num_file; ++i)
-      fh[i] = sc.Open(dirname + filename_prefix + std::to_string(i));
+      paths.push_back(dirname + filename_prefix + std::to_string(i));
+    std::vector<int> fh = sc.OpenMany(paths);
     all_thd_ready.count_down();
     all_node_ready.wait();
     auto deadline =
         std::chrono::system_clock::now() + std::chrono::seconds(duration);
     while (std::chrono::system_clock::now() <= deadline) {
       double res = write_lottery(gen);
+      auto start = std::chrono::steady_clock::now();
       if (res < write_ratio) {  // write
         sc.SetContent(fh[file_lottery(gen)], "garbage" + std::to_string(res));
+        write_lat[thd_num].record(std::chrono::steady_clock::now() - start);
         ++write_ops[thd_num];
       } else {  // read
         sc.GetContent(fh[file_lottery(gen)]);
+        read_lat[thd_num].record(std::chrono::steady_clock::now() - start);
         ++read_ops[thd_num];
       }
     }
+    cache_stats[thd_num] = sc.GetCacheStats();
   };
 
   auto file_count = [](std::string&& content) {
@@ -96,14 +269,35 @@ int main(int argc, char** argv) {
   all_node_ready.count_down();
 
   for (auto& t : vt) t.join();
+  CacheStats sum_cache{0, 0, 0, 0};
+  Histogram sum_read_lat, sum_write_lat;
   for (int i = 0; i < thd_cnt; ++i) {
     sum_read_ops += read_ops[i];
     sum_write_ops += write_ops[i];
+    sum_read_lat.merge(read_lat[i]);
+    sum_write_lat.merge(write_lat[i]);
+    if (options.shared_connection && i > 0) continue;  // same cache
+    sum_cache.hits += cache_stats[i].hits;
+    sum_cache.misses += cache_stats[i].misses;
+    sum_cache.evictions += cache_stats[i].evictions;
   }
 
   sc.Delete(mynodefh);
 
+  if (json) {
+    std::cout << "{\"read_ops\":" << sum_read_ops
+              << ",\"write_ops\":" << sum_write_ops
+              << ",\"cache_hits\":" << sum_cache.hits
+              << ",\"cache_misses\":" << sum_cache.misses
+              << ",\"cache_evictions\":" << sum_cache.evictions
+              << ",\"read_us\":" << sum_read_lat.json()
+              << ",\"write_us\":" << sum_write_lat.json() << "}" << std::endl;
+    return 0;
+  }
   std::cout << "sum_read_ops=" << sum_read_ops
-            << ", sum_write_ops=" << sum_write_ops << std::endl;
+            << ", sum_write_ops=" << sum_write_ops
+            << ", cache_hits=" << sum_cache.hits
+            << ", cache_misses=" << sum_cache.misses
+            << ", cache_evictions=" << sum_cache.evictions << std::endl;
   return 0;
 }
\ No newline at end of file
@@ -3,24 +3,24 @@ from tool import *
 from conf import *
 import sys
 
-def run_client(node_num, client_cnt, thd_cnt, dur, write_ratio, lat = False):
+def run_client(node_num, client_cnt, thd_cnt, dur, write_ratio, lat = False, flags = ""):
     # if (node_num >= SERVER_NODE_START and node_num < CLIENT_NODE_START):
     #     # run server
     #     ssh(node_num, f"{TARGET_DIR}/server {node_num}", save_output=True)
     if (node_num >= CLIENT_NODE_START):
         # run client
-        ssh(node_num, f"LD_LIBRARY_PATH={TARGET_DIR} {TARGET_DIR}/{'lat' if lat else 'perf'}_client {node_num} {client_cnt} {thd_cnt} {dur} {write_ratio}", save_output=True)
+        ssh(node_num, f"LD_LIBRARY_PATH={TARGET_DIR} {TARGET_DIR}/{'lat' if lat else 'perf'}_client {node_num} {client_cnt} {thd_cnt} {dur} {write_ratio} {flags}", save_output=True)
 
-def run_exp(client_cnt, thd_cnt, dur, write_ratio, lat =  False):
+def run_exp(client_cnt, thd_cnt, dur, write_ratio, lat =  False, flags = ""):
     for server in range(SERVER_NODE_START, CLIENT_NODE_START):
         ssh(server, f"pkill -e sven_server")
     sleep(0.5)
     for server in range(SERVER_NODE_START, CLIENT_NODE_START):
-        ssh(server, f"tmux send-keys -t {TMUX_SES_NAME}.0 {TARGET_DIR}sven_server Space {server} ENTER")
+        ssh(server, f"tmux send-keys -t {TMUX_SES_NAME}.0 {TARGET_DIR}sven_server Space {server} Space --stats-interval Space 10 ENTER")
     sleep(3)
     thd = []
     for node_num in range(CLIENT_NODE_START, CLIENT_NODE_START + int(client_cnt)):
-        thd.append(Thread(target=run_client, args=[node_num, client_cnt, thd_cnt, dur, write_ratio, lat]))
+        thd.append(Thread(target=run_client, args=[node_num, client_cnt, thd_cnt, dur, write_ratio, lat, flags]))
         thd[-1].start()
     for i in range(int(client_cnt)):
         thd[i].join()
@@ -55,8 +55,8 @@ def run_exp(client_cnt, thd_cnt, dur, write_ratio, lat =  False):
         f.write("\n")
 
 if __name__=="__main__":
-    # argv[1:] == [client_cnt thd_cnt duration write_ratio] 
-    if len(sys.argv) != 5:
-        print("argv[1:] == [client_cnt thd_cnt duration write_ratio]")
+    # argv[1:] == [client_cnt thd_cnt duration write_ratio [perf_client flags...]]
+    if len(sys.argv) < 5:
+        print("argv[1:] == [client_cnt thd_cnt duration write_ratio [perf_client flags...]]")
         exit(1)
-    run_exp(sys.argv[1], sys.argv[2], sys.argv[3], sys.argv[4])
\ No newline at end of file
+    run_exp(sys.argv[1], sys.argv[2], sys.argv[3], sys.argv[4], flags=" ".join(sys.argv[5:]))
\ No newline at end of file
@@ -0,0 +1,269 @@
+// Replays a trace recorded by the client library (clientlib_trace.h, with
+// $SKINNY_TRACE or SkinnyClientOptions::trace_path) against the cluster of
+// $SKINNY_CONFIG, and prints the latency of the replayed calls as JSON:
+//   trace_replay <trace> [speed]
+// A speed of 2 replays the trace in half the time. Each traced session is
+// replayed by its own client on its own thread, its calls made at their
+// recorded times; a blocking call that overruns delays the session's next
+// calls, as it did when recorded. Written contents are 'x's of the recorded
+// size.
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../clientlib.h"
+#include "../clientlib_trace.h"
+#include "../histogram.h"
+
+using Clock = std::chrono::steady_clock;
+
+// What the replay of all sessions measured. Asynchronous calls complete on
+// the client library's threads, hence the lock.
+struct Replayed {
+  void record(Clock::time_point due, bool ok, bool recorded_ok) {
+    std::lock_guard lg(mutex);
+    latency.record(Clock::now() - due);
+    ++ops;
+    if (!ok) ++errors;
+    if (!ok && recorded_ok) ++new_errors;
+  }
+
+  std::mutex mutex;
+  Histogram latency;  // from when each call was due
+  uint64_t ops = 0;
+  uint64_t errors = 0;
+  uint64_t new_errors = 0;  // of calls that succeeded when recorded
+};
+
+class Session {
+ public:
+  explicit Session(Replayed &replayed) : replayed_(replayed) {}
+
+  ~Session() {
+    // Callbacks of asynchronous calls refer to this session
+    std::unique_lock lk(mutex_);
+    cv_.wait(lk, [this] { return pending_ == 0; });
+  }
+
+  void replay(const TraceRecord &r, Clock::time_point due) {
+    if (r.op == TraceOp::START) return;
+    if (r.op == TraceOp::END) {
+      sc_.reset();
+      fhs_.clear();
+      return;
+    }
+    if (!sc_) sc_.emplace();
+    const bool recorded_ok = !(r.flags & TraceRecord::FAILED);
+    if (r.flags & TraceRecord::ASYNC && r.op != TraceOp::OPEN) {
+      replay_async(r, due, recorded_ok);
+      return;
+    }
+    bool ok = true;
+    try {
+      call(r);
+    } catch (const SkinnyError &) {
+      ok = false;
+    }
+    replayed_.record(due, ok, recorded_ok);
+  }
+
+ private:
+  // The handle of this replay for a handle of the trace
+  int fh(int recorded) const {
+    auto it = fhs_.find(recorded);
+    return it == fhs_.end() ? recorded : it->second;
+  }
+  void map(const std::vector<int> &recorded, const std::vector<int> &fhs) {
+    for (size_t i = 0; i < recorded.size() && i < fhs.size(); ++i) {
+      fhs_[recorded[i]] = fhs[i];
+    }
+  }
+  std::string content(const TraceRecord &r) const {
+    return std::string(r.sizes.empty() ? 0 : r.sizes[0], 'x');
+  }
+
+  void call(const TraceRecord &r) {
+    auto &sc = *sc_;
+    const bool ex = r.flags & TraceRecord::EXCLUSIVE;
+    const bool eph = r.flags & TraceRecord::EPHEMERAL;
+    std::optional<std::function<void(int)>> cb;
+    if (r.flags & TraceRecord::CALLBACK) cb = [](int) {};
+    switch (r.op) {
+      case TraceOp::OPEN: {
+        int opened;
+        if (r.flags & TraceRecord::ASYNC) {
+          // Waited for, as the session's next calls use its handle
+          opened = sc.OpenAsync(r.paths.at(0), eph).get();
+        } else if (r.flags & TraceRecord::DIRECTORY) {
+          opened = sc.OpenDir(r.paths.at(0), cb, eph);
+        } else {
+          opened = sc.Open(r.paths.at(0), cb, eph);
+        }
+        map(r.results, {opened});
+        break;
+      }
+      case TraceOp::OPEN_MANY:
+        map(r.results, sc.OpenMany(r.paths, cb, eph));
+        break;
+      case TraceOp::CLOSE:
+        sc.Close(fh(r.fhs.at(0)));
+        fhs_.erase(r.fhs.at(0));
+        break;
+      case TraceOp::CLOSE_MANY: {
+        std::vector<int> fhs;
+        for (int recorded : r.fhs) fhs.push_back(fh(recorded));
+        sc.CloseMany(fhs);
+        for (int recorded : r.fhs) fhs_.erase(recorded);
+        break;
+      }
+      case TraceOp::GET_CONTENT:
+        sc.GetContent(fh(r.fhs.at(0)));
+        break;
+      case TraceOp::GET_CONTENT_MANY: {
+        std::vector<int> fhs;
+        for (int recorded : r.fhs) fhs.push_back(fh(recorded));
+        sc.GetContentMany(fhs);
+        break;
+      }
+      case TraceOp::GET_CONTENT_BY_PATH:
+        sc.GetContentByPath(r.paths.at(0), r.flags & TraceRecord::WATCH);
+        break;
+      case TraceOp::SET_CONTENT:
+        sc.SetContent(fh(r.fhs.at(0)), content(r));
+        break;
+      case TraceOp::TXN: {
+        auto guards = r.guards;
+        auto ops = r.ops;
+        for (auto &g : guards) g.fh = fh(g.fh);
+        for (auto &op : ops) op.fh = fh(op.fh);
+        map(r.results, sc.Txn(guards, ops).fhs);
+        break;
+      }
+      case TraceOp::TRY_ACQUIRE:
+        sc.TryAcquire(fh(r.fhs.at(0)), ex);
+        break;
+      case TraceOp::ACQUIRE:
+        sc.Acquire(fh(r.fhs.at(0)), ex);
+        break;
+      case TraceOp::RELEASE:
+        sc.Release(fh(r.fhs.at(0)));
+        break;
+      case TraceOp::DELETE:
+        sc.Delete(fh(r.fhs.at(0)));
+        fhs_.erase(r.fhs.at(0));
+        break;
+      case TraceOp::START:
+      case TraceOp::END:
+        break;
+    }
+  }
+
+  // Issues an asynchronous call and records it when it completes
+  void replay_async(const TraceRecord &r, Clock::time_point due,
+                    bool recorded_ok) {
+    {
+      std::lock_guard lg(mutex_);
+      ++pending_;
+    }
+    auto done = [this, due, recorded_ok]<typename T>(std::future<T> result) {
+      bool ok = true;
+      try {
+        result.get();
+      } catch (const SkinnyError &) {
+        ok = false;
+      }
+      replayed_.record(due, ok, recorded_ok);
+      std::lock_guard lg(mutex_);
+      if (--pending_ == 0) cv_.notify_all();
+    };
+    auto &sc = *sc_;
+    const int handle = fh(r.fhs.at(0));
+    const bool ex = r.flags & TraceRecord::EXCLUSIVE;
+    switch (r.op) {
+      case TraceOp::CLOSE:
+        sc.CloseAsync(handle, AsyncCallback<void>(done));
+        fhs_.erase(r.fhs.at(0));
+        break;
+      case TraceOp::GET_CONTENT:
+        sc.GetContentAsync(handle, AsyncCallback<std::string>(done));
+        break;
+      case TraceOp::SET_CONTENT:
+        sc.SetContentAsync(handle, content(r), AsyncCallback<void>(done));
+        break;
+      case TraceOp::TRY_ACQUIRE:
+        sc.TryAcquireAsync(handle, ex, AsyncCallback<bool>(done));
+        break;
+      case TraceOp::ACQUIRE:
+        sc.AcquireAsync(handle, ex, AsyncCallback<bool>(done));
+        break;
+      case TraceOp::RELEASE:
+        sc.ReleaseAsync(handle, AsyncCallback<void>(done));
+        break;
+      case TraceOp::DELETE:
+        sc.DeleteAsync(handle, AsyncCallback<void>(done));
+        fhs_.erase(r.fhs.at(0));
+        break;
+      default:
+        throw std::runtime_error("Bad asynchronous call in trace");
+    }
+  }
+
+  Replayed &replayed_;
+  std::optional<SkinnyClient> sc_;
+  std::map<int, int> fhs_;  // recorded handle: replayed handle
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int pending_ = 0;  // asynchronous calls not completed
+};
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <trace> [speed]" << std::endl;
+    return 1;
+  }
+  const double speed = argc > 2 ? std::stod(argv[2]) : 1;
+  std::map<uint32_t, std::vector<TraceRecord>> sessions;
+  for (auto &r : read_trace(argv[1])) {
+    sessions[r.client].push_back(std::move(r));
+  }
+  for (auto &[client, records] : sessions) {
+    // Asynchronous calls were written when they completed
+    std::stable_sort(records.begin(), records.end(),
+                     [](auto &a, auto &b) { return a.time_us < b.time_us; });
+  }
+
+  Replayed replayed;
+  const auto start = Clock::now() + std::chrono::milliseconds(100);
+  std::vector<std::thread> vt;
+  for (auto &[client, records] : sessions) {
+    vt.emplace_back([&, &records = records] {
+      Session session(replayed);
+      for (auto &r : records) {
+        auto due = start + std::chrono::duration_cast<Clock::duration>(
+                               std::chrono::microseconds(r.time_us) / speed);
+        std::this_thread::sleep_until(due);
+        session.replay(r, due);
+      }
+    });
+  }
+  for (auto &t : vt) t.join();
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  std::cout << "{\"sessions\":" << sessions.size() << ",\"speed\":" << speed
+            << ",\"ops\":" << replayed.ops << ",\"errors\":" << replayed.errors
+            << ",\"new_errors\":" << replayed.new_errors
+            << ",\"seconds\":" << elapsed.count()
+            << ",\"latency_us\":" << replayed.latency.json() << "}"
+            << std::endl;
+  return 0;
+}
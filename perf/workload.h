@@ -0,0 +1,256 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../clientlib.h"
+
+// A synthetic workload, read from a file of "<name> <values...>" lines ('#'
+// starts a comment), e.g. perf/hotkeys.workload:
+//   keys 1000                 files /perf/key<i>
+//   zipf 0.99                 key skew, 0 for uniform
+//   value_size lognormal 200 1.0   or "fixed <n>", "uniform <min> <max>";
+//                             lognormal takes the median and sigma
+//   mix get=80 set=15 acquire=2 release=2 open=0.5 close=0.5 delete=0
+//       ephemeral=0           relative weights of the operations
+//   think_time_us 0           mean (exponential) pause between a thread's
+//                             ops, in closed-loop runs
+//   watchers 10               extra sessions holding every key open and
+//                             cached, so each set invalidates them all
+struct WorkloadSpec {
+  enum Op { OPEN, CLOSE, GET, SET, ACQUIRE, RELEASE, DELETE, EPHEMERAL };
+  static constexpr std::array<const char *, 8> kOpNames = {
+      "open",    "close",   "get",    "set",
+      "acquire", "release", "delete", "ephemeral"};
+
+  int keys = 10;
+  double zipf = 0;
+  std::string value_size = "fixed";
+  double value_a = 16, value_b = 0;
+  std::array<double, kOpNames.size()> mix{0, 0, 90, 10, 0, 0, 0, 0};
+  std::chrono::microseconds think_time{0};
+  int watchers = 0;
+};
+
+inline WorkloadSpec load_workload_spec(const std::string &path) {
+  std::ifstream in(path);
+  if (!in) throw std::runtime_error("Cannot read workload " + path);
+  WorkloadSpec spec;
+  std::string line;
+  while (std::getline(in, line)) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    std::string name;
+    if (!(fields >> name)) continue;
+    bool ok = true;
+    if (name == "keys") {
+      ok = bool(fields >> spec.keys) && spec.keys > 0;
+    } else if (name == "zipf") {
+      ok = bool(fields >> spec.zipf);
+    } else if (name == "value_size") {
+      ok = bool(fields >> spec.value_size >> spec.value_a);
+      if (spec.value_size != "fixed") ok = ok && (fields >> spec.value_b);
+    } else if (name == "mix") {
+      spec.mix.fill(0);
+      std::string weight;
+      while (ok && fields >> weight) {
+        auto eq = weight.find('=');
+        auto it = std::find(spec.kOpNames.begin(), spec.kOpNames.end(),
+                            weight.substr(0, eq));
+        ok = eq != std::string::npos && it != spec.kOpNames.end();
+        if (ok) {
+          spec.mix[it - spec.kOpNames.begin()] =
+              std::stod(weight.substr(eq + 1));
+        }
+      }
+    } else if (name == "think_time_us") {
+      int us;
+      ok = bool(fields >> us);
+      spec.think_time = std::chrono::microseconds(us);
+    } else if (name == "watchers") {
+      ok = bool(fields >> spec.watchers);
+    } else {
+      ok = false;
+    }
+    if (!ok) throw std::runtime_error("Bad line in workload: " + line);
+  }
+  return spec;
+}
+
+// Draws 0..n-1 with P(k) proportional to 1 / (k + 1)^s, by a binary search
+// of the precomputed CDF. Key 0 is the hottest.
+class ZipfDistribution {
+ public:
+  ZipfDistribution(int n, double s) : cdf_(n) {
+    double sum = 0;
+    for (int k = 0; k < n; ++k) cdf_[k] = sum += std::pow(k + 1.0, -s);
+    for (auto &p : cdf_) p /= sum;
+  }
+  template <typename Gen>
+  int operator()(Gen &gen) {
+    double u = std::uniform_real_distribution<>(0, 1)(gen);
+    return std::min<int>(std::lower_bound(cdf_.begin(), cdf_.end(), u) -
+                             cdf_.begin(),
+                         cdf_.size() - 1);
+  }
+
+ private:
+  std::vector<double> cdf_;
+};
+
+// Runs a WorkloadSpec. Each thread has its own client, random generator
+// (seeded by the thread, so runs repeat) and handles, which are opened on
+// the first op that needs them.
+class SpecWorkload {
+ public:
+  static constexpr size_t kMaxValue = 1 << 20;
+
+  SpecWorkload(const WorkloadSpec &spec, const std::string &dir, int threads)
+      : spec_(spec),
+        dir_(dir),
+        zipf_(spec.keys, spec.zipf),
+        ops_(spec.mix.begin(), spec.mix.end()) {
+    for (int t = 0; t < threads; ++t) {
+      threads_.push_back(std::make_unique<Thread>(t));
+    }
+    std::vector<std::string> paths;
+    for (int k = 0; k < spec.keys; ++k) paths.push_back(path(k));
+    for (int i = 0; i < spec.watchers; ++i) {
+      auto &sc = watchers_.emplace_back(std::make_unique<SkinnyClient>());
+      sc->GetContentMany(sc->OpenMany(paths));
+    }
+  }
+
+  void operator()(int t, uint64_t) {
+    auto &th = *threads_[t];
+    auto op = WorkloadSpec::Op(ops_(th.gen));
+    int key = zipf_(th.gen);
+    try {
+      run(th, op, key);
+    } catch (const SkinnyError &) {
+      // e.g. another thread deleted the file; reopen it next time
+      th.fhs.erase(key);
+      forget_lock(th, key);
+      throw;
+    }
+  }
+
+  // Pause of thread `t` before its next op
+  std::chrono::microseconds think_time(int t) {
+    if (spec_.think_time.count() == 0) return spec_.think_time;
+    std::exponential_distribution<> pause(1.0 / spec_.think_time.count());
+    return std::chrono::microseconds(int64_t(pause(threads_[t]->gen)));
+  }
+
+ private:
+  struct Thread {
+    explicit Thread(int t) : index(t), gen(t) {}
+    const int index;
+    SkinnyClient sc;
+    std::mt19937_64 gen;
+    std::map<int, int> fhs;  // key: handle
+    std::vector<int> locks;  // keys locked
+    uint64_t ephemerals = 0;
+  };
+
+  std::string path(int key) const {
+    return dir_ + "/key" + std::to_string(key);
+  }
+
+  int handle(Thread &th, int key) {
+    auto it = th.fhs.find(key);
+    if (it != th.fhs.end()) return it->second;
+    return th.fhs[key] = th.sc.Open(path(key));
+  }
+
+  // Closing a handle or deleting its file releases the lock
+  static void forget_lock(Thread &th, int key) {
+    th.locks.erase(std::remove(th.locks.begin(), th.locks.end(), key),
+                   th.locks.end());
+  }
+
+  size_t value_size(Thread &th) {
+    double size = spec_.value_a;
+    if (spec_.value_size == "uniform") {
+      size = std::uniform_real_distribution<>(spec_.value_a,
+                                              spec_.value_b)(th.gen);
+    } else if (spec_.value_size == "lognormal") {
+      size = std::lognormal_distribution<>(std::log(spec_.value_a),
+                                           spec_.value_b)(th.gen);
+    }
+    return std::clamp<size_t>(size, 0, kMaxValue);
+  }
+
+  void run(Thread &th, WorkloadSpec::Op op, int key) {
+    switch (op) {
+      case WorkloadSpec::OPEN: {
+        int fh = th.sc.Open(path(key));
+        if (auto it = th.fhs.find(key); it != th.fhs.end()) {
+          th.sc.Close(it->second);  // which releases its lock
+          forget_lock(th, key);
+        }
+        th.fhs[key] = fh;
+        break;
+      }
+      case WorkloadSpec::CLOSE:
+        if (auto it = th.fhs.find(key); it != th.fhs.end()) {
+          th.sc.Close(it->second);
+          th.fhs.erase(it);
+          forget_lock(th, key);
+        }
+        break;
+      case WorkloadSpec::GET:
+        th.sc.GetContent(handle(th, key));
+        break;
+      case WorkloadSpec::SET:
+        th.sc.SetContent(handle(th, key), std::string(value_size(th), 'x'));
+        break;
+      case WorkloadSpec::ACQUIRE:
+        if (std::find(th.locks.begin(), th.locks.end(), key) ==
+                th.locks.end() &&
+            th.sc.TryAcquire(handle(th, key), true)) {
+          th.locks.push_back(key);
+        }
+        break;
+      case WorkloadSpec::RELEASE:
+        // The oldest lock this thread holds, whatever the key
+        if (!th.locks.empty()) {
+          int locked = th.locks.front();
+          th.locks.erase(th.locks.begin());
+          th.sc.Release(handle(th, locked));
+        }
+        break;
+      case WorkloadSpec::DELETE:
+        th.sc.Delete(handle(th, key));
+        th.fhs.erase(key);
+        forget_lock(th, key);
+        break;
+      case WorkloadSpec::EPHEMERAL: {
+        // Created, then deleted by closing its only handle
+        auto ephemeral = dir_ + "/ephemeral" + std::to_string(th.index) +
+                         "_" + std::to_string(th.ephemerals++);
+        th.sc.Close(th.sc.Open(ephemeral, std::nullopt, true));
+        break;
+      }
+    }
+  }
+
+  const WorkloadSpec spec_;
+  const std::string dir_;
+  ZipfDistribution zipf_;
+  std::discrete_distribution<> ops_;
+  std::vector<std::unique_ptr<Thread>> threads_;
+  std::vector<std::unique_ptr<SkinnyClient>> watchers_;
+};
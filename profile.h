@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "histogram.h"
+
+// Sampled spans of the server's hot paths, for profiling a live server.
+// While sampling is on (set_sampling(n), from the Diagnostic service), one
+// top-level span in n on each thread is recorded with the spans nested in
+// it: its name, thread, start, duration and heap allocations. Spans go to a
+// ring buffer per stripe of threads, the oldest overwritten, and come out
+// in the Chrome trace format. With sampling off a span costs a thread-local
+// counter and a relaxed load.
+namespace profile {
+struct SpanRecord {
+  const char *name;
+  int thread;
+  uint64_t start_ns;  // since the process started
+  uint64_t duration_ns;
+  uint64_t allocations;  // operator new calls, nested spans' included
+};
+
+inline const auto epoch = std::chrono::steady_clock::now();
+inline std::atomic<uint32_t> sample_every{0};
+
+// Constant-initialized, so that operator new can touch it on any thread
+struct ThreadState {
+  int depth = 0;
+  bool sampled = false;  // the current top-level span is
+  uint64_t spans = 0;
+  uint64_t allocations = 0;  // while sampled
+};
+inline thread_local ThreadState thread_state;
+
+// Called by the server's operator new
+inline void count_allocation() {
+  if (thread_state.sampled) ++thread_state.allocations;
+}
+
+class Ring {
+ public:
+  static constexpr size_t kCapacity = 4096;
+
+  void push(const SpanRecord &span) {
+    std::lock_guard lg(mutex_);
+    spans_[next_++ % kCapacity] = span;
+  }
+  void append_to(std::vector<SpanRecord> &out) {
+    std::lock_guard lg(mutex_);
+    out.insert(out.end(), spans_.begin(),
+               spans_.begin() + std::min<uint64_t>(next_, kCapacity));
+  }
+  void clear() {
+    std::lock_guard lg(mutex_);
+    next_ = 0;
+  }
+
+ private:
+  std::mutex mutex_;
+  uint64_t next_ = 0;
+  std::array<SpanRecord, kCapacity> spans_;
+};
+
+inline constexpr int kRings = 16;
+inline std::array<Ring, kRings> rings;
+
+// Records one top-level span in `every` from now on, with its nested spans,
+// dropping the spans recorded so far. 0 stops sampling and keeps them.
+inline void set_sampling(uint32_t every) {
+  if (every) {
+    for (auto &ring : rings) ring.clear();
+  }
+  sample_every.store(every, std::memory_order_relaxed);
+}
+
+inline uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - epoch)
+      .count();
+}
+
+// Times the enclosing scope as `name`, a string literal
+class Span {
+ public:
+  explicit Span(const char *name) : name_(name) {
+    auto &t = thread_state;
+    if (t.depth++ == 0) {
+      uint32_t every = sample_every.load(std::memory_order_relaxed);
+      t.sampled = every && ++t.spans % every == 0;
+    }
+    if (!t.sampled) return;
+    sampled_ = true;
+    allocations_ = t.allocations;
+    start_ns_ = now_ns();
+  }
+  ~Span() {
+    auto &t = thread_state;
+    if (sampled_) {
+      int thread = thread_stripe();
+      rings[thread % kRings].push({name_, thread, start_ns_,
+                                   now_ns() - start_ns_,
+                                   t.allocations - allocations_});
+    }
+    if (--t.depth == 0) t.sampled = false;
+  }
+  Span(const Span &) = delete;
+  Span &operator=(const Span &) = delete;
+
+ private:
+  const char *name_;
+  bool sampled_ = false;
+  uint64_t allocations_ = 0;
+  uint64_t start_ns_ = 0;
+};
+
+// The recorded spans as Chrome trace JSON, for chrome://tracing or Perfetto
+inline std::string chrome_trace() {
+  std::vector<SpanRecord> spans;
+  for (auto &ring : rings) ring.append_to(spans);
+  std::sort(spans.begin(), spans.end(), [](auto &a, auto &b) {
+    return a.start_ns < b.start_ns;
+  });
+  std::string out = "{\"traceEvents\":[";
+  char buf[256];
+  for (auto &span : spans) {
+    std::snprintf(buf, sizeof(buf),
+                  "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                  "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"allocations\":%llu}}",
+                  &span == spans.data() ? "" : ",", span.name, span.thread,
+                  span.start_ns / 1e3, span.duration_ns / 1e3,
+                  (unsigned long long)span.allocations);
+    out += buf;
+  }
+  return out + "],\"displayTimeUnit\":\"ns\"}";
+}
+}  // namespace profile
@@ -2,54 +2,375 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "clientlib.h"
 #include "clientlib_diagnostic.h"
 
 namespace py = pybind11;
 
+// Runs the Python side of watch events and of asynchronous calls. The
+// client library reports each on a thread of its own, which only queues a
+// task here, without the GIL; one thread takes the queue in batches and
+// runs a whole batch under one acquisition of the GIL, so that an
+// invalidation storm or thousands of calls in flight do not have threads
+// fighting for it.
+class EventDispatcher {
+ public:
+  using Task = std::function<void()>;  // run with the GIL
+
+  static EventDispatcher &get() {
+    static EventDispatcher dispatcher;
+    return dispatcher;
+  }
+  static bool started() { return started_.load(); }
+
+  void push(Task task) {
+    {
+      std::lock_guard lg(mutex_);
+      queue_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+  }
+
+  // At interpreter exit, before Python can no longer run the callbacks.
+  // Events still queued are dropped.
+  void stop() {
+    {
+      std::lock_guard lg(mutex_);
+      stopped_ = true;
+    }
+    cv_.notify_one();
+    py::gil_scoped_release release;
+    if (t_.joinable()) t_.join();
+  }
+
+ private:
+  EventDispatcher() : t_([this] { run(); }) { started_.store(true); }
+  ~EventDispatcher() {
+    if (t_.joinable()) t_.detach();
+  }
+
+  void run() {
+    std::unique_lock ul(mutex_);
+    while (true) {
+      cv_.wait(ul, [this] { return stopped_ || !queue_.empty(); });
+      if (stopped_) return;
+      std::vector<Task> batch;
+      batch.swap(queue_);
+      ul.unlock();
+      {
+        py::gil_scoped_acquire acquire;
+        for (auto &task : batch) {
+          try {
+            task();
+          } catch (py::error_already_set &e) {
+            e.discard_as_unraisable("Skinny event callback");
+          }
+        }
+        batch.clear();  // tasks may hold the last reference to objects
+      }
+      ul.lock();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Task> queue_;
+  bool stopped_ = false;
+  std::thread t_;
+  static inline std::atomic<bool> started_{false};
+};
+
+// Events of the handles opened with it as their callback, for asyncio:
+//   async for fhs in stream:
+// yields the handles of the events that arrived since the last iteration,
+// in order, and waits for one if there are none. Drain() takes them without
+// waiting. A stream has one reader.
+class EventStream : public std::enable_shared_from_this<EventStream> {
+ public:
+  ~EventStream() {
+    py::gil_scoped_acquire acquire;
+    waiter_ = py::object();
+  }
+
+  // From the dispatcher, with the GIL. The waiting iteration is resolved on
+  // its own loop, with whatever arrived by then.
+  void push(int fh) {
+    pending_.push_back(fh);
+    if (!waiter_) return;
+    auto waiter = std::move(waiter_);
+    waiter.attr("get_loop")().attr("call_soon_threadsafe")(
+        py::cpp_function([self = shared_from_this()](py::object waiter) {
+          // Cancelled, the events wait for the next iteration
+          if (!waiter.attr("done")().cast<bool>()) {
+            waiter.attr("set_result")(self->Drain());
+          }
+        }),
+        waiter);
+  }
+
+  std::vector<int> Drain() {
+    std::vector<int> fhs(pending_.begin(), pending_.end());
+    pending_.clear();
+    return fhs;
+  }
+
+  py::object Next() {
+    auto waiter = py::module_::import("asyncio")
+                      .attr("get_running_loop")()
+                      .attr("create_future")();
+    if (!pending_.empty()) {
+      waiter.attr("set_result")(Drain());
+    } else {
+      waiter_ = waiter;
+    }
+    return waiter;
+  }
+
+ private:
+  std::deque<int> pending_;
+  py::object waiter_;  // future of the iteration waiting for events
+};
+
+// The callback to give the client library for `cb`, a Python callable or an
+// EventStream. Needs the GIL; the callback does not.
+std::optional<std::function<void(int)>> event_callback(const py::object &cb) {
+  if (cb.is_none()) return std::nullopt;
+  // Shared, so that queueing an event copies no Python object
+  std::shared_ptr<const std::function<void(int)>> target;
+  if (py::isinstance<EventStream>(cb)) {
+    target = std::make_shared<const std::function<void(int)>>(
+        [stream = cb.cast<std::shared_ptr<EventStream>>()](int fh) {
+          stream->push(fh);
+        });
+  } else {
+    target = std::make_shared<const std::function<void(int)>>(
+        cb.cast<std::function<void(int)>>());
+  }
+  auto &dispatcher = EventDispatcher::get();
+  return [&dispatcher, target](int fh) {
+    dispatcher.push([target, fh] { (*target)(fh); });
+  };
+}
+
+// The SkinnyError type of the module. Leaked, like every Python object kept
+// in a static, as it must not be released after the interpreter finalizes.
+py::object *skinny_error_type;
+
+// Starts an asynchronous call of the client library, start(done), and
+// returns an asyncio future for its result on the running loop. The result
+// is converted to Python on the dispatcher thread, in a batch with other
+// results and events, and set on the loop by call_soon_threadsafe.
+template <typename T, typename Start>
+py::object awaitable(Start &&start) {
+  static auto *resolve = new py::object(
+      py::cpp_function([](py::object waiter, bool ok, py::object value) {
+        if (waiter.attr("done")().cast<bool>()) return;  // cancelled
+        waiter.attr(ok ? "set_result" : "set_exception")(value);
+      }));
+  auto loop = py::module_::import("asyncio").attr("get_running_loop")();
+  // Released with the GIL, wherever its last copy goes
+  std::shared_ptr<py::object> waiter(
+      new py::object(loop.attr("create_future")()), [](py::object *p) {
+        py::gil_scoped_acquire acquire;
+        delete p;
+      });
+  py::object returned = *waiter;
+  auto &dispatcher = EventDispatcher::get();
+  py::gil_scoped_release release;
+  start(AsyncCallback<T>([&dispatcher, waiter](std::future<T> result) {
+    auto shared = std::make_shared<std::future<T>>(std::move(result));
+    dispatcher.push([waiter, shared] {
+      bool ok = true;
+      py::object value;
+      try {
+        if constexpr (std::is_void_v<T>) {
+          shared->get();
+          value = py::none();
+        } else if constexpr (std::is_same_v<T, std::string>) {
+          value = py::bytes(shared->get());
+        } else {
+          value = py::cast(shared->get());
+        }
+      } catch (const SkinnyError &e) {
+        ok = false;
+        value = (*skinny_error_type)(e.what());
+      } catch (const std::exception &e) {
+        ok = false;
+        value = py::reinterpret_borrow<py::object>(PyExc_RuntimeError)(
+            e.what());
+      }
+      waiter->attr("get_loop")().attr("call_soon_threadsafe")(
+          *resolve, *waiter, ok, value);
+    });
+  }));
+  return returned;
+}
+
+// Runs a blocking call of SkinnyClient, with no asynchronous version in the
+// client library, on the loop's default executor
+template <typename Call>
+py::object in_executor(Call &&call) {
+  auto loop = py::module_::import("asyncio").attr("get_running_loop")();
+  return loop.attr("run_in_executor")(py::none(),
+                                      py::cpp_function(std::move(call)));
+}
+
+// Content handed to Python without a copy, as a read-only buffer
+struct Content {
+  std::string data;
+};
+
 PYBIND11_MODULE(pyclientlib, m) {
+  skinny_error_type = new py::object(py::register_exception<SkinnyError>(
+      m, "SkinnyError", PyExc_RuntimeError));
+  // Replaces the servers read from $SKINNY_CONFIG for the clients made from
+  // now on; for tests with servers that join the cluster later
+  m.def(
+      "SetConfig",
+      [](const std::string &path) { SRV_CONFIG = load_cluster_config(path); },
+      py::arg("path"));
+  py::class_<TxnGuard> txn_guard(m, "TxnGuard");
+  py::enum_<TxnGuard::Type>(txn_guard, "Type")
+      .value("EXISTS", TxnGuard::EXISTS)
+      .value("NOT_EXISTS", TxnGuard::NOT_EXISTS)
+      .value("CONTENT_GEN_EQ", TxnGuard::CONTENT_GEN_EQ)
+      .value("NOT_LOCKED", TxnGuard::NOT_LOCKED)
+      .value("LOCKED_BY_ME", TxnGuard::LOCKED_BY_ME)
+      .export_values();
+  txn_guard
+      .def(py::init([](TxnGuard::Type type, int fh, std::string path,
+                       int value) {
+             return TxnGuard{type, fh, path, value};
+           }),
+           py::arg("type"), py::arg("fh") = -1, py::arg("path") = "",
+           py::arg("value") = 0)
+      .def_readwrite("type", &TxnGuard::type)
+      .def_readwrite("fh", &TxnGuard::fh)
+      .def_readwrite("path", &TxnGuard::path)
+      .def_readwrite("value", &TxnGuard::value);
+  py::class_<TxnOp> txn_op(m, "TxnOp");
+  py::enum_<TxnOp::Type>(txn_op, "Type")
+      .value("SET_CONTENT", TxnOp::SET_CONTENT)
+      .value("OPEN", TxnOp::OPEN)
+      .value("DELETE", TxnOp::DELETE)
+      .value("CLOSE", TxnOp::CLOSE)
+      .export_values();
+  txn_op
+      .def(py::init([](TxnOp::Type type, int fh, std::string path,
+                       std::string content, bool is_directory,
+                       bool is_ephemeral) {
+             return TxnOp{type, fh, path, content, is_directory, is_ephemeral};
+           }),
+           py::arg("type"), py::arg("fh") = -1, py::arg("path") = "",
+           py::arg("content") = "", py::arg("is_directory") = false,
+           py::arg("is_ephemeral") = false)
+      .def_readwrite("type", &TxnOp::type)
+      .def_readwrite("fh", &TxnOp::fh)
+      .def_readwrite("path", &TxnOp::path)
+      .def_readwrite("content", &TxnOp::content);
+  py::class_<TxnResult>(m, "TxnResult")
+      .def_readonly("succeeded", &TxnResult::succeeded)
+      .def_readonly("failed_guard", &TxnResult::failed_guard)
+      .def_readonly("fhs", &TxnResult::fhs);
+  py::class_<Content>(m, "Content", py::buffer_protocol())
+      .def_buffer([](Content& c) {
+        return py::buffer_info(c.data.data(), 1,
+                               py::format_descriptor<uint8_t>::format(), 1,
+                               {c.data.size()}, {1}, true);
+      });
+  py::class_<EventStream, std::shared_ptr<EventStream>>(m, "EventStream")
+      .def(py::init())
+      .def("Drain", &EventStream::Drain)
+      .def("__aiter__", [](py::object self) { return self; })
+      .def("__anext__", &EventStream::Next);
+  py::module_::import("atexit").attr("register")(
+      py::cpp_function([] {
+        if (EventDispatcher::started()) EventDispatcher::get().stop();
+      }));
   py::class_<SkinnyClient>(m, "SkinnyClient")
       .def(py::init(), py::call_guard<py::gil_scoped_release>())
+      .def(py::init([](size_t cache_bytes, bool shared_connection,
+                       int call_timeout_ms, bool hedge_reads,
+                       bool read_from_observer, int observer_id,
+                       int preferred_server) {
+             SkinnyClientOptions options;
+             options.cache_bytes = cache_bytes;
+             options.shared_connection = shared_connection;
+             options.call_timeout = std::chrono::milliseconds(call_timeout_ms);
+             options.hedge_reads = hedge_reads;
+             options.read_from_observer = read_from_observer;
+             options.observer_id = observer_id;
+             options.preferred_server = preferred_server;
+             return std::make_unique<SkinnyClient>(options);
+           }),
+           py::call_guard<py::gil_scoped_release>(),
+           py::arg("cache_bytes") = SkinnyClientOptions{}.cache_bytes,
+           py::arg("shared_connection") = false,
+           py::arg("call_timeout_ms") =
+               SkinnyClientOptions{}.call_timeout.count(),
+           py::arg("hedge_reads") = false,
+           py::arg("read_from_observer") = false, py::arg("observer_id") = -1,
+           py::arg("preferred_server") = -1)
       .def(
           "Open",
-          [](SkinnyClient& sc, std::string& path,
-             std::optional<std::function<void(int)>>& cb, bool is_ephemeral) {
-            if (cb) {
-              return sc.Open(
-                  path,
-                  [cb](int fh) {
-                    py::gil_scoped_acquire acquire;
-                    std::invoke(cb.value(), fh);
-                  },
-                  is_ephemeral);
-            } else {
-              return sc.Open(path, std::nullopt, is_ephemeral);
-            }
+          [](SkinnyClient& sc, std::string& path, const py::object& cb,
+             bool is_ephemeral) {
+            auto callback = event_callback(cb);
+            py::gil_scoped_release release;
+            return sc.Open(path, callback, is_ephemeral);
           },
-          py::call_guard<py::gil_scoped_release>(), py::arg("path"),
-          py::arg("cb") = std::nullopt, py::arg("is_ephemeral") = false)
+          py::arg("path"), py::arg("cb") = py::none(),
+          py::arg("is_ephemeral") = false)
       .def(
           "OpenDir",
-          [](SkinnyClient& sc, std::string& path,
-             std::optional<std::function<void(int)>>& cb, bool is_ephemeral) {
-            if (cb) {
-              return sc.OpenDir(
-                  path,
-                  [cb](int fh) {
-                    py::gil_scoped_acquire acquire;
-                    std::invoke(cb.value(), fh);
-                  },
-                  is_ephemeral);
-            } else {
-              return sc.OpenDir(path, std::nullopt, is_ephemeral);
-            }
+          [](SkinnyClient& sc, std::string& path, const py::object& cb,
+             bool is_ephemeral) {
+            auto callback = event_callback(cb);
+            py::gil_scoped_release release;
+            return sc.OpenDir(path, callback, is_ephemeral);
           },
-          py::call_guard<py::gil_scoped_release>(), py::arg("path"),
-          py::arg("cb") = std::nullopt, py::arg("is_ephemeral") = false)
+          py::arg("path"), py::arg("cb") = py::none(),
+          py::arg("is_ephemeral") = false)
       .def("Close", &SkinnyClient::Close,
            py::call_guard<py::gil_scoped_release>())
+      .def(
+          "OpenMany",
+          [](SkinnyClient& sc, std::vector<std::string>& paths,
+             const py::object& cb, bool is_ephemeral) {
+            auto callback = event_callback(cb);
+            py::gil_scoped_release release;
+            return sc.OpenMany(paths, callback, is_ephemeral);
+          },
+          py::arg("paths"), py::arg("cb") = py::none(),
+          py::arg("is_ephemeral") = false)
+      .def(
+          "GetContentMany",
+          [](SkinnyClient& sc, std::vector<int>& fhs) {
+            std::vector<std::string> result = sc.GetContentMany(fhs);
+            {
+              py::gil_scoped_acquire acquire;
+              py::list contents;
+              for (auto& content : result) contents.append(py::bytes(content));
+              return contents;
+            }
+          },
+          py::call_guard<py::gil_scoped_release>())
+      .def("CloseMany", &SkinnyClient::CloseMany,
+           py::call_guard<py::gil_scoped_release>())
       .def("SetContent", &SkinnyClient::SetContent,
            py::call_guard<py::gil_scoped_release>())
       .def(
@@ -62,6 +383,42 @@ PYBIND11_MODULE(pyclientlib, m) {
             }
           },
           py::call_guard<py::gil_scoped_release>())
+      .def(
+          "GetContentView",
+          [](SkinnyClient& sc, int fh) {
+            auto content = std::make_unique<Content>();
+            {
+              py::gil_scoped_release release;
+              content->data = sc.GetContent(fh);
+            }
+            return py::memoryview(py::cast(std::move(content)));
+          })
+      .def(
+          "GetContentByPath",
+          [](SkinnyClient& sc, const std::string& path, bool watch) {
+            auto result = sc.GetContentByPath(path, watch);
+            {
+              py::gil_scoped_acquire acquire;
+              return result ? py::object(py::bytes(result.value()))
+                            : py::object(py::none());
+            }
+          },
+          py::call_guard<py::gil_scoped_release>(), py::arg("path"),
+          py::arg("watch") = true)
+      .def(
+          "GetContentWithGen",
+          [](SkinnyClient& sc, int fh) {
+            int gen;
+            std::string result = sc.GetContent(fh, &gen);
+            {
+              py::gil_scoped_acquire acquire;
+              return py::make_tuple(py::bytes(result), gen);
+            }
+          },
+          py::call_guard<py::gil_scoped_release>())
+      .def("CompareAndSet", &SkinnyClient::CompareAndSet,
+           py::call_guard<py::gil_scoped_release>())
+      .def("Txn", &SkinnyClient::Txn, py::call_guard<py::gil_scoped_release>())
       .def("TryAcquire", &SkinnyClient::TryAcquire,
            py::call_guard<py::gil_scoped_release>())
       .def("Acquire", &SkinnyClient::Acquire,
@@ -69,8 +426,198 @@ PYBIND11_MODULE(pyclientlib, m) {
       .def("Release", &SkinnyClient::Release,
            py::call_guard<py::gil_scoped_release>())
       .def("Delete", &SkinnyClient::Delete,
-           py::call_guard<py::gil_scoped_release>());
+           py::call_guard<py::gil_scoped_release>())
+      // Awaitable versions of the calls, for asyncio. Those with an
+      // asynchronous version in the client library take no thread while in
+      // flight; the others run on the loop's default executor.
+      .def(
+          "OpenAsync",
+          [](SkinnyClient& sc, const std::string& path, const py::object& cb,
+             bool is_ephemeral) {
+            if (!cb.is_none()) {
+              return in_executor([&sc, path, callback = event_callback(cb),
+                                  is_ephemeral] {
+                py::gil_scoped_release release;
+                return sc.Open(path, callback, is_ephemeral);
+              });
+            }
+            return awaitable<int>([&](AsyncCallback<int> done) {
+              sc.OpenAsync(path, std::move(done), is_ephemeral);
+            });
+          },
+          py::arg("path"), py::arg("cb") = py::none(),
+          py::arg("is_ephemeral") = false)
+      .def(
+          "OpenDirAsync",
+          [](SkinnyClient& sc, const std::string& path, const py::object& cb,
+             bool is_ephemeral) {
+            return in_executor([&sc, path, callback = event_callback(cb),
+                                is_ephemeral] {
+              py::gil_scoped_release release;
+              return sc.OpenDir(path, callback, is_ephemeral);
+            });
+          },
+          py::arg("path"), py::arg("cb") = py::none(),
+          py::arg("is_ephemeral") = false)
+      .def(
+          "OpenManyAsync",
+          [](SkinnyClient& sc, const std::vector<std::string>& paths,
+             const py::object& cb, bool is_ephemeral) {
+            return in_executor([&sc, paths, callback = event_callback(cb),
+                                is_ephemeral] {
+              py::gil_scoped_release release;
+              return sc.OpenMany(paths, callback, is_ephemeral);
+            });
+          },
+          py::arg("paths"), py::arg("cb") = py::none(),
+          py::arg("is_ephemeral") = false)
+      .def("CloseAsync",
+           [](SkinnyClient& sc, int fh) {
+             return awaitable<void>([&](AsyncCallback<void> done) {
+               sc.CloseAsync(fh, std::move(done));
+             });
+           })
+      .def("CloseManyAsync",
+           [](SkinnyClient& sc, const std::vector<int>& fhs) {
+             return in_executor([&sc, fhs] {
+               py::gil_scoped_release release;
+               sc.CloseMany(fhs);
+             });
+           })
+      .def("GetContentAsync",
+           [](SkinnyClient& sc, int fh) {
+             return awaitable<std::string>(
+                 [&](AsyncCallback<std::string> done) {
+                   sc.GetContentAsync(fh, std::move(done));
+                 });
+           })
+      .def("GetContentManyAsync",
+           [](SkinnyClient& sc, const std::vector<int>& fhs) {
+             return in_executor([&sc, fhs] {
+               std::vector<std::string> result;
+               {
+                 py::gil_scoped_release release;
+                 result = sc.GetContentMany(fhs);
+               }
+               py::list contents;
+               for (auto& content : result) contents.append(py::bytes(content));
+               return contents;
+             });
+           })
+      .def(
+          "GetContentByPathAsync",
+          [](SkinnyClient& sc, const std::string& path, bool watch) {
+            return in_executor([&sc, path, watch] {
+              std::optional<std::string> result;
+              {
+                py::gil_scoped_release release;
+                result = sc.GetContentByPath(path, watch);
+              }
+              return result ? py::object(py::bytes(result.value()))
+                            : py::object(py::none());
+            });
+          },
+          py::arg("path"), py::arg("watch") = true)
+      .def("SetContentAsync",
+           [](SkinnyClient& sc, int fh, const std::string& content) {
+             return awaitable<void>([&](AsyncCallback<void> done) {
+               sc.SetContentAsync(fh, content, std::move(done));
+             });
+           })
+      .def("CompareAndSetAsync",
+           [](SkinnyClient& sc, int fh, int content_gen,
+              const std::string& content) {
+             return in_executor([&sc, fh, content_gen, content] {
+               py::gil_scoped_release release;
+               return sc.CompareAndSet(fh, content_gen, content);
+             });
+           })
+      .def("TxnAsync",
+           [](SkinnyClient& sc, const std::vector<TxnGuard>& guards,
+              const std::vector<TxnOp>& ops) {
+             return in_executor([&sc, guards, ops] {
+               py::gil_scoped_release release;
+               return sc.Txn(guards, ops);
+             });
+           })
+      .def("TryAcquireAsync",
+           [](SkinnyClient& sc, int fh, bool ex) {
+             return awaitable<bool>([&](AsyncCallback<bool> done) {
+               sc.TryAcquireAsync(fh, ex, std::move(done));
+             });
+           })
+      .def("AcquireAsync",
+           [](SkinnyClient& sc, int fh, bool ex) {
+             return awaitable<bool>([&](AsyncCallback<bool> done) {
+               sc.AcquireAsync(fh, ex, std::move(done));
+             });
+           })
+      .def("ReleaseAsync",
+           [](SkinnyClient& sc, int fh) {
+             return awaitable<void>([&](AsyncCallback<void> done) {
+               sc.ReleaseAsync(fh, std::move(done));
+             });
+           })
+      .def("DeleteAsync",
+           [](SkinnyClient& sc, int fh) {
+             return awaitable<void>([&](AsyncCallback<void> done) {
+               sc.DeleteAsync(fh, std::move(done));
+             });
+           })
+      .def("GetCacheStats", [](const SkinnyClient& sc) {
+        auto stats = sc.GetCacheStats();
+        py::dict d;
+        d["hits"] = stats.hits;
+        d["misses"] = stats.misses;
+        d["evictions"] = stats.evictions;
+        d["bytes"] = stats.bytes;
+        return d;
+      });
+  py::class_<ServerConfig>(m, "ServerConfig")
+      .def_readonly("id", &ServerConfig::id)
+      .def_readonly("host", &ServerConfig::host)
+      .def_readonly("port", &ServerConfig::port)
+      .def_readonly("learner", &ServerConfig::learner);
   py::class_<SkinnyDiagnosticClient>(m, "SkinnyDiagnosticClient")
       .def(py::init())
-      .def("GetLeader", &SkinnyDiagnosticClient::GetLeader);
+      .def("GetLeader", &SkinnyDiagnosticClient::GetLeader)
+      .def("AddServer", &SkinnyDiagnosticClient::AddServer,
+           py::call_guard<py::gil_scoped_release>(), py::arg("id"),
+           py::arg("host"), py::arg("port"), py::arg("learner") = false)
+      .def("RemoveServer", &SkinnyDiagnosticClient::RemoveServer,
+           py::call_guard<py::gil_scoped_release>())
+      .def("YieldLeadership", &SkinnyDiagnosticClient::YieldLeadership,
+           py::call_guard<py::gil_scoped_release>())
+      .def("GetMembers", &SkinnyDiagnosticClient::GetMembers,
+           py::call_guard<py::gil_scoped_release>())
+      .def(
+          "GetStats",
+          [](SkinnyDiagnosticClient& dc, int id) {
+            diagnostic::Stats stats;
+            {
+              py::gil_scoped_release release;
+              stats = dc.GetStats(id);
+            }
+            py::dict d;
+            auto* descriptor = stats.GetDescriptor();
+            auto* reflection = stats.GetReflection();
+            for (int i = 0; i < descriptor->field_count(); ++i) {
+              auto* field = descriptor->field(i);
+              if (field->is_repeated()) continue;
+              d[py::str(std::string(field->name()))] =
+                  reflection->GetUInt64(stats, field);
+            }
+            py::dict waiters;
+            for (auto& w : stats.lock_waiters()) {
+              waiters[py::str(w.path())] = w.waiters();
+            }
+            d["lock_waiters"] = waiters;
+            return d;
+          },
+          py::arg("id"))
+      .def("SetProfiling", &SkinnyDiagnosticClient::SetProfiling,
+           py::call_guard<py::gil_scoped_release>(), py::arg("id"),
+           py::arg("sample_every"))
+      .def("GetProfile", &SkinnyDiagnosticClient::GetProfile,
+           py::call_guard<py::gil_scoped_release>(), py::arg("id"));
 }
@@ -4,15 +4,23 @@
 #include <grpcpp/server_context.h>
 #include <grpcpp/support/server_callback.h>
 #include <grpcpp/support/sync_stream.h>
+#include <netinet/in.h>
 #include <signal.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <condition_variable>
+#include <cstdlib>
 #include <exception>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <shared_mutex>
 #include <thread>
 
 #include "SkinnyImpl.cpp"
@@ -23,12 +31,62 @@
 #include "libnuraft/nuraft.hxx"
 #include "libnuraft/srv_config.hxx"
 #include "logger_wrapper.hxx"
+#include "profile.h"
 #include "raft_server.hxx"
+#include "stats.h"
 #include "utils.h"
 
+// Counts the allocations of sampled spans (profile.h)
+void *operator new(size_t size) {
+  profile::count_allocation();
+  if (void *p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  profile::count_allocation();
+  return std::malloc(size ? size : 1);
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
 class DiagnosticImpl final : public diagnostic::Diagnostic::Service {
  public:
-  DiagnosticImpl(std::shared_ptr<nuraft::raft_server> raft) : raft_(raft){};
+  DiagnosticImpl(std::shared_ptr<nuraft::raft_server> raft,
+                 std::shared_ptr<DataStore> ds,
+                 std::shared_ptr<session::Db> sdb,
+                 nuraft::ptr<nuraft::log_store> log_store)
+      : raft_(raft), ds_(ds), sdb_(sdb), log_store_(log_store){};
+
+  // Gauges are read from the server's state here; counters were kept per
+  // thread in stats.h and are summed here.
+  void collect(diagnostic::Stats *res) {
+    res->set_commit_index(raft_->get_target_committed_log_idx());
+    res->set_applied_index(raft_->get_committed_log_idx());
+    res->set_apply_lag(res->commit_index() -
+                       std::min(res->commit_index(), res->applied_index()));
+    res->set_log_size(log_store_->next_slot() - log_store_->start_index());
+    // Reads running counters only, so that it never holds up the apply path
+    auto sessions = sdb_->stats();
+    res->set_sessions(sessions.sessions);
+    res->set_open_handles(sessions.open_handles);
+    res->set_lease_timers(sessions.lease_timers);
+    res->set_event_queue_depth(sessions.event_queue_depth);
+    res->set_max_event_queue_depth(sessions.max_event_queue_depth);
+    auto waiters = ds_->lock_waiters();
+    auto top = waiters.begin() + std::min(waiters.size(), kTopLockWaiters);
+    std::partial_sort(waiters.begin(), top, waiters.end(), std::greater<>());
+    for (auto it = waiters.begin(); it != top; ++it) {
+      auto *w = res->add_lock_waiters();
+      w->set_path(it->second);
+      w->set_waiters(it->first);
+    }
+    res->set_invalidations_sent(stats::invalidations_sent.value());
+    auto ops = stats::proposal_ops.snapshot();
+    res->set_proposals(ops.count());
+    res->set_proposal_ops_p50(ops.percentile(50));
+    res->set_proposal_ops_p99(ops.percentile(99));
+    res->set_proposal_ops_max(ops.max());
+  }
 
  private:
   grpc::Status GetLeader(ServerContext *context, const diagnostic::Empty *,
@@ -36,17 +94,200 @@ class DiagnosticImpl final : public diagnostic::Diagnostic::Service {
     res->set_leader(raft_->get_leader());
     return Status::OK;
   }
+
+  grpc::Status AddServer(ServerContext *context, const diagnostic::Server *req,
+                         diagnostic::Empty *) override {
+    const auto endpoint = req->host() + ":" + std::to_string(req->port());
+    auto status = membership_status(
+        raft_->add_srv({req->id(), 0, endpoint, "", req->learner()}));
+    if (!status.ok()) return status;
+    return wait_for_member(req->id(), true);
+  }
+
+  grpc::Status RemoveServer(ServerContext *context,
+                            const diagnostic::ServerId *req,
+                            diagnostic::Empty *) override {
+    auto status = membership_status(raft_->remove_srv(req->id()));
+    if (!status.ok()) return status;
+    return wait_for_member(req->id(), false);
+  }
+
+  grpc::Status YieldLeadership(ServerContext *context,
+                               const diagnostic::Empty *,
+                               diagnostic::Empty *) override {
+    if (!raft_->is_leader()) {
+      return Status(
+          static_cast<grpc::StatusCode>(skinny::ErrorCode::NOT_LEADER),
+          std::to_string(raft_->get_leader()));
+    }
+    int self = raft_->get_id();
+    raft_->yield_leadership();
+    auto deadline = std::chrono::steady_clock::now() + kMembershipTimeout;
+    while (raft_->get_leader() == self || raft_->get_leader() == -1) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        return Status(grpc::StatusCode::DEADLINE_EXCEEDED,
+                      "No other server took the leadership");
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return Status::OK;
+  }
+
+  grpc::Status GetMembers(ServerContext *context, const diagnostic::Empty *,
+                          diagnostic::Members *res) override {
+    std::vector<nuraft::ptr<nuraft::srv_config>> configs;
+    raft_->get_srv_config_all(configs);
+    res->set_leader(raft_->get_leader());
+    for (auto &config : configs) {
+      auto *server = res->add_servers();
+      auto [host, port] = split_endpoint(config->get_endpoint());
+      server->set_id(config->get_id());
+      server->set_host(host);
+      server->set_port(port);
+      server->set_learner(config->is_learner());
+    }
+    return Status::OK;
+  }
+
+  grpc::Status GetStats(ServerContext *context, const diagnostic::Empty *,
+                        diagnostic::Stats *res) override {
+    collect(res);
+    return Status::OK;
+  }
+
+  grpc::Status SetProfiling(ServerContext *context,
+                            const diagnostic::Profiling *req,
+                            diagnostic::Empty *) override {
+    profile::set_sampling(req->sample_every());
+    return Status::OK;
+  }
+
+  grpc::Status GetProfile(ServerContext *context, const diagnostic::Empty *,
+                          diagnostic::Profile *res) override {
+    res->set_chrome_trace(profile::chrome_trace());
+    return Status::OK;
+  }
+
+  grpc::Status membership_status(
+      nuraft::ptr<nuraft::cmd_result<nuraft::ptr<nuraft::buffer>>> r) {
+    if (r->get_accepted() && r->get_result_code() == nuraft::OK) {
+      return Status::OK;
+    } else if (r->get_result_code() == nuraft::NOT_LEADER) {
+      return Status(
+          static_cast<grpc::StatusCode>(skinny::ErrorCode::NOT_LEADER),
+          std::to_string(raft_->get_leader()));
+    }
+    return Status(grpc::StatusCode::ABORTED, r->get_result_str());
+  }
+
+  // add_srv and remove_srv only start the change. Waits until the
+  // configuration has (or no longer has) server `id`.
+  grpc::Status wait_for_member(int id, bool member) {
+    auto deadline = std::chrono::steady_clock::now() + kMembershipTimeout;
+    while ((raft_->get_srv_config(id) != nullptr) != member) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        return Status(grpc::StatusCode::DEADLINE_EXCEEDED,
+                      "Membership change did not complete");
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return Status::OK;
+  }
+
+  static constexpr size_t kTopLockWaiters = 10;
+  static constexpr auto kMembershipTimeout = std::chrono::seconds(5);
+
   std::shared_ptr<nuraft::raft_server> raft_;
+  std::shared_ptr<DataStore> ds_;
+  std::shared_ptr<session::Db> sdb_;
+  nuraft::ptr<nuraft::log_store> log_store_;
 };
 
+// Stats in the Prometheus text format, e.g. "skinny_sessions 3"
+std::string prometheus_text(const diagnostic::Stats &stats) {
+  std::string text;
+  auto *descriptor = stats.GetDescriptor();
+  auto *reflection = stats.GetReflection();
+  for (int i = 0; i < descriptor->field_count(); ++i) {
+    auto *field = descriptor->field(i);
+    if (field->is_repeated()) continue;
+    text += "skinny_" + std::string(field->name()) + " " +
+            std::to_string(reflection->GetUInt64(stats, field)) + "\n";
+  }
+  for (auto &w : stats.lock_waiters()) {
+    std::string path;
+    for (char c : w.path()) {
+      if (c == '"' || c == '\\') path += '\\';
+      path += c;
+    }
+    text += "skinny_lock_waiters{path=\"" + path + "\"} " +
+            std::to_string(w.waiters()) + "\n";
+  }
+  return text;
+}
+
+// Answers every HTTP request on `port` with prometheus_text(), one at a time
+void serve_metrics(int port, DiagnosticImpl &diagnostic) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+      listen(fd, 16) < 0) {
+    perror("metrics endpoint");
+    return;
+  }
+  std::cout << "Metrics on port " << port << std::endl;
+  while (true) {
+    int conn = accept(fd, nullptr, nullptr);
+    if (conn < 0) continue;
+    timeval timeout{1, 0};
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char request[4096];
+    // Whatever it asks for, unless the client hung up or never sent it
+    if (read(conn, request, sizeof(request)) <= 0) {
+      close(conn);
+      continue;
+    }
+    diagnostic::Stats stats;
+    diagnostic.collect(&stats);
+    auto body = prometheus_text(stats);
+    auto reply =
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " +
+        std::to_string(body.size()) + "\r\n\r\n" + body;
+    for (size_t sent = 0; sent < reply.size();) {
+      auto n = write(conn, reply.data() + sent, reply.size() - sent);
+      if (n <= 0) break;
+      sent += n;
+    }
+    close(conn);
+  }
+}
+
+const ServerConfig &config_of(int node_id) {
+  for (auto &server : SRV_CONFIG) {
+    if (server.id == node_id) return server;
+  }
+  throw std::runtime_error("Node " + std::to_string(node_id) +
+                           " is not in the cluster config");
+}
+
 auto init_grpc(int node_id, std::shared_ptr<nuraft::raft_server> raft,
-               std::shared_ptr<DataStore> ds,
-               std::shared_ptr<session::Db> sdb) {
-  std::string server_address(
-      "0.0.0.0:" + std::to_string(std::get<1>(SRV_CONFIG[node_id]) + 1));
-  SkinnyImpl service(raft, ds, sdb);
-  SkinnyCbImpl cbservice(raft, sdb);
-  DiagnosticImpl diagnostic(raft);
+               std::shared_ptr<DataStore> ds, std::shared_ptr<session::Db> sdb,
+               nuraft::ptr<nuraft::log_store> log_store, int metrics_port) {
+  std::string server_address("0.0.0.0:" +
+                             std::to_string(config_of(node_id).port + 1));
+  auto leader = std::make_shared<LeaderStubs>(raft);
+  SkinnyImpl service(raft, ds, sdb, leader, config_of(node_id).learner);
+  SkinnyCbImpl cbservice(raft, sdb, leader);
+  DiagnosticImpl diagnostic(raft, ds, sdb, log_store);
+  if (metrics_port) {
+    std::thread(serve_metrics, metrics_port, std::ref(diagnostic)).detach();
+  }
   grpc::ServerBuilder builder;
   // Listen on the given address without any authentication mechanism.
   builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
@@ -66,11 +307,14 @@ auto init_grpc(int node_id, std::shared_ptr<nuraft::raft_server> raft,
   return server;
 }
 
-auto init_raft(int node_id, std::shared_ptr<DataStore> ds,
-               std::shared_ptr<session::Db> sdb) {
+// Unless `join`, waits until every other server in the config is added. A
+// joining server is added later with the AddServer RPC.
+auto init_raft(int node_id, bool join, std::shared_ptr<DataStore> ds,
+               std::shared_ptr<session::Db> sdb,
+               nuraft::ptr<nuraft::log_store> &log_store) {
   using namespace nuraft;
   bool inited = false;
-  const auto [host, port] = SRV_CONFIG[node_id];
+  const auto &[id, host, port, learner] = config_of(node_id);
   const auto endpoint = host + ":" + std::to_string(port);
   // Replace with your logger, state machine, and state manager.
   // std::string log_file_name = "./srv" + std::to_string(node_id) + ".log";
@@ -80,6 +324,7 @@ auto init_raft(int node_id, std::shared_ptr<DataStore> ds,
   ptr<state_machine> my_state_machine =
       cs_new<StateMachine::StateMachine>(ds, sdb);
   ptr<state_mgr> my_state_manager = cs_new<inmem_state_mgr>(node_id, endpoint);
+  log_store = my_state_manager->load_log_store();
 
   asio_service::options asio_opt;  // your Asio options
   raft_params params;              // your Raft parameters
@@ -89,7 +334,9 @@ auto init_raft(int node_id, std::shared_ptr<DataStore> ds,
   opt.raft_callback_ = [sdb, &inited](cb_func::Type type, cb_func::Param *) {
     if (type == cb_func::Type::BecomeLeader) {
       if (inited) std::cout << "I am now the leader" << std::endl;
-      sdb->start_kathread();
+      sdb->restore_leases();
+    } else if (type == cb_func::Type::BecomeFollower) {
+      sdb->end_leases();
     }
     return cb_func::ReturnCode::Ok;
   };
@@ -104,16 +351,15 @@ auto init_raft(int node_id, std::shared_ptr<DataStore> ds,
     std::this_thread::sleep_for(std::chrono::milliseconds(100));
   }
 
-  for (int i = 0; i < SRV_CONFIG.size(); i++) {
-    if (i == node_id) continue;
-    std::cout << "Waiting for node " << i << std::endl;
-    const auto [fhost, fport] = SRV_CONFIG[i];
+  for (const auto &[fid, fhost, fport, flearner] : SRV_CONFIG) {
+    if (join || fid == node_id) continue;
+    std::cout << "Waiting for node " << fid << std::endl;
     const auto fendpoint = fhost + ":" + std::to_string(fport);
     ptr<srv_config> ret;
     do {
-      server->add_srv({i, fendpoint})->get_result_code();
+      server->add_srv({fid, 0, fendpoint, "", flearner})->get_result_code();
       std::this_thread::sleep_for(std::chrono::milliseconds(100));
-      ret = server->get_srv_config(i);
+      ret = server->get_srv_config(fid);
     } while (ret == nullptr);
   }
   inited = true;
@@ -122,59 +368,52 @@ auto init_raft(int node_id, std::shared_ptr<DataStore> ds,
   return launcher;
 }
 
-void notify_events(FileMetaData &meta, session::Db &sdb_) {
-  std::vector<std::thread> vt;
-  for (auto it = meta.subscribers.begin(); it != meta.subscribers.end();) {
-    auto session = sdb_.find_session(it->first);
-    if (session && session->handle_inum(it->second) != -1) {
-      auto eid = session->enqueue_event(it->second);
-      if (eid) {
-        vt.emplace_back([session, eid = eid.value()]() {
-          session->block_until_event_acked(eid);
-        });
-      }
-      it++;
-    } else {
-      it = meta.subscribers.erase(it);
-    }
-  }
-  for (auto &t : vt) {
-    t.join();
-  }
-}
-
 int main(int argc, char **argv) {
+  // server <node id> [--config <cluster config file>] [--join]
+  //        [--metrics-port <port for Prometheus>]
+  //        [--stats-interval <seconds between stage timer reports>]
   assert(argc >= 2);
   const int node_id = atoi(argv[1]);
+  bool join = false;
+  int metrics_port = 0;
+  int stats_interval = 0;
+  for (int i = 2; i < argc; ++i) {
+    if (std::string(argv[i]) == "--config" && i + 1 < argc) {
+      SRV_CONFIG = load_cluster_config(argv[++i]);
+    } else if (std::string(argv[i]) == "--join") {
+      join = true;
+    } else if (std::string(argv[i]) == "--metrics-port" && i + 1 < argc) {
+      metrics_port = atoi(argv[++i]);
+    } else if (std::string(argv[i]) == "--stats-interval" && i + 1 < argc) {
+      stats_interval = atoi(argv[++i]);
+    }
+  }
   auto datastore = std::make_shared<DataStore>();
   nuraft::ptr<nuraft::raft_server> raft = nullptr;
   std::shared_ptr<session::Db> sdb = nullptr;
-  sdb = std::make_shared<session::Db>([&raft, &datastore, &sdb](int sid) {
-    if (!raft || !raft->is_leader() || !sdb) return;
-    std::thread t([&raft, &datastore, sid, &sdb]() {
-      action::EndSessionAction a(sid);
-      auto ret = raft->append_entries({a.serialize()});
-      if (ret->get_result_code() == nuraft::OK) {
-        nuraft::buffer_serializer bs(*ret->get());
-        if (bs.get_i32() != 0) return;
-        bs.get_str();
-        int size = bs.get_i32();
-        for (int i = 0; i < size; i++) {
-          auto &[meta, content] = datastore->at(bs.get_str());
-          notify_events(meta, *sdb);
-        }
-      }
-    });
-    t.detach();
-    return;
+  std::unique_ptr<SessionReaper> reaper = nullptr;
+  sdb = std::make_shared<session::Db>([&raft, &reaper](int sid) {
+    if (!raft || !raft->is_leader() || !reaper) return;
+    reaper->expire(sid);
   });
 
   datastore->operator[]("/");
   datastore->at("/").first.file_exists = true;
   datastore->at("/").first.is_directory = true;
-  auto launcher = init_raft(node_id, datastore, sdb);
+  nuraft::ptr<nuraft::log_store> log_store;
+  auto launcher = init_raft(node_id, join, datastore, sdb, log_store);
   raft = launcher.get_raft_server();
-  auto server = init_grpc(node_id, launcher.get_raft_server(), datastore, sdb);
+  reaper = std::make_unique<SessionReaper>(raft, datastore, sdb);
+  if (stats_interval > 0) {
+    std::thread([stats_interval] {
+      while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(stats_interval));
+        stats::report(std::cout);
+      }
+    }).detach();
+  }
+  auto server = init_grpc(node_id, launcher.get_raft_server(), datastore, sdb,
+                          log_store, metrics_port);
   // Wait for the server to shutdown. Note that some other thread must be
   // responsible for shutting down the server for this call to ever return.
   launcher.shutdown();
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+
+#include "histogram.h"
+
+namespace stats {
+// A counter added to from many threads. Like SharedHistogram, each thread
+// adds to its own stripe, and value() sums them.
+class Counter {
+ public:
+  void add(uint64_t n = 1) {
+    stripes_[thread_stripe() % kStripes].value.fetch_add(
+        n, std::memory_order_relaxed);
+  }
+  uint64_t value() const {
+    uint64_t sum = 0;
+    for (auto &stripe : stripes_) {
+      sum += stripe.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+ private:
+  static constexpr int kStripes = 16;
+  struct alignas(64) Stripe {
+    std::atomic<uint64_t> value{0};
+  };
+  std::array<Stripe, kStripes> stripes_;
+};
+
+// Cache invalidations and path events queued to sessions
+inline Counter invalidations_sent;
+// Operations per log entry: the ops of a Txn (and OpenMany/CloseMany), the
+// sessions of an EndSessions, and 1 otherwise
+inline SharedHistogram proposal_ops;
+
+// Where the time of a write goes on the server, stage by stage
+
+// A commit waiting for the apply lock, held by reads and other commits
+inline SharedHistogram queue_wait;
+// append_entries: replication to a quorum, and the apply on this server
+inline SharedHistogram append;
+// StateMachine::commit, under the apply lock
+inline SharedHistogram apply;
+// Sending the invalidations of one change and waiting for their acks
+inline SharedHistogram fanout;
+// A whole SetContent on the leader
+inline SharedHistogram set_content;
+
+// Prints one JSON line with every stage, unless nothing was recorded since
+// the last call. Latencies are cumulative, in microseconds.
+inline void report(std::ostream &out) {
+  static uint64_t last_count = 0;
+  const std::pair<const char *, SharedHistogram *> stages[] = {
+      {"queue_wait", &queue_wait}, {"append", &append},
+      {"apply", &apply},           {"fanout", &fanout},
+      {"set_content", &set_content}};
+  std::string line;
+  uint64_t count = 0;
+  for (auto [name, h] : stages) {
+    auto snapshot = h->snapshot();
+    count += snapshot.count();
+    line += (line.empty() ? "{\"" : ",\"") + std::string(name) +
+            "\":" + snapshot.json();
+  }
+  if (count == last_count) return;
+  last_count = count;
+  out << line << "}" << std::endl;
+}
+}  // namespace stats
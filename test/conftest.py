@@ -6,9 +6,14 @@ import subprocess
 import logging
 import time
 from typing import List
-from skinny_client import SkinnyDiagnosticClient
 import multiprocessing
 
+TEST_DIR = os.path.dirname(os.path.realpath(__file__))
+# Read by the client library when it is loaded
+os.environ["SKINNY_CONFIG"] = os.path.join(TEST_DIR, "cluster.conf")
+
+from skinny_client import SetConfig, SkinnyDiagnosticClient
+
 server_addrs = [
     "127.0.0.1",
     "127.0.0.1",
@@ -23,20 +28,25 @@ BIN_DIR = "debug"
 async def scp():
     multiprocessing.set_start_method("spawn")
     asyncssh.set_log_level(100)
-    build_dir = os.path.join(os.path.dirname(os.path.realpath(__file__)), "..", BIN_DIR)
+    build_dir = os.path.join(TEST_DIR, "..", BIN_DIR)
     for s in server_addrs:
-        subprocess.run(
-            [
-                "scp",
-                "-o",
-                "StrictHostKeyChecking=no",
-                "-o",
-                "UserKnownHostsFile=/dev/null",
-                os.path.join(build_dir, "server"),
-                f"{s}:/tmp/{PREFIX}server",
-            ],
-            check=True,
-        )
+        for src, dst in [
+            (os.path.join(build_dir, "server"), "server"),
+            (os.path.join(TEST_DIR, "cluster.conf"), "cluster.conf"),
+            (os.path.join(TEST_DIR, "cluster_join.conf"), "cluster_join.conf"),
+        ]:
+            subprocess.run(
+                [
+                    "scp",
+                    "-o",
+                    "StrictHostKeyChecking=no",
+                    "-o",
+                    "UserKnownHostsFile=/dev/null",
+                    src,
+                    f"{s}:/tmp/{PREFIX}{dst}",
+                ],
+                check=True,
+            )
     logging.info("scp completed")
 
 
@@ -46,16 +56,22 @@ def event_loop():
 
 
 class Server:
-    def __init__(self, conn: asyncssh.SSHClientConnection, node_number):
+    def __init__(
+        self,
+        conn: asyncssh.SSHClientConnection,
+        node_number,
+        args=f"--config /tmp/{PREFIX}cluster.conf",
+    ):
         self.conn = conn
         self.node_number = node_number
+        self.args = args
         self.tmux_ses_name = f"{PREFIX}test_{self.node_number}"
 
     async def start(self):
         await self.conn.run(f"pkill -f '/tmp/{PREFIX}server {self.node_number}'")
         await self.conn.run(f"tmux new-session -d -s {self.tmux_ses_name} 'bash'")
         await self.conn.run(
-            f"tmux send-keys -t {self.tmux_ses_name}.1 '/tmp/{PREFIX}server {self.node_number}' ENTER"
+            f"tmux send-keys -t {self.tmux_ses_name}.1 '/tmp/{PREFIX}server {self.node_number} {self.args}' ENTER"
         )
 
     async def close(self):
@@ -94,3 +110,15 @@ async def cluster():
     for c in servs:
         await c.close()
     time.sleep(2)
+
+
+@pytest.fixture
+def join_cluster(cluster):
+    """
+    The cluster, with the clients made from now on also knowing server 3,
+    which joins it with --join (cluster_join.conf)
+    """
+    SetConfig(os.path.join(TEST_DIR, "cluster_join.conf"))
+    cluster.client = SkinnyDiagnosticClient()
+    yield cluster
+    SetConfig(os.path.join(TEST_DIR, "cluster.conf"))
@@ -2,4 +2,4 @@
 import sys
 import os
 sys.path.append(os.path.realpath(os.path.join(os.path.dirname(os.path.realpath(__file__)), "..", "build")))
-from pyclientlib import SkinnyClient, SkinnyDiagnosticClient
+from pyclientlib import EventStream, SetConfig, SkinnyClient, SkinnyDiagnosticClient, TxnGuard, TxnOp
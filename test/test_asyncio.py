@@ -0,0 +1,203 @@
+from skinny_client import SkinnyClient, TxnOp
+from conftest import Cluster
+import asyncio
+import pytest
+
+
+async def test_awaitable_calls(cluster: Cluster):
+    """
+    Test that the awaitable calls can be gathered on one loop
+    """
+    a = SkinnyClient()
+    await a.OpenDirAsync("/aio")
+    fhs = await asyncio.gather(*(a.OpenAsync(f"/aio/{i}") for i in range(100)))
+    assert len(set(fhs)) == 100
+    await asyncio.gather(*(a.SetContentAsync(fh, str(fh)) for fh in fhs))
+    contents = await asyncio.gather(*(a.GetContentAsync(fh) for fh in fhs))
+    assert contents == [str(fh).encode() for fh in fhs]
+    assert await a.GetContentManyAsync(fhs[:2]) == contents[:2]
+
+    assert await a.TryAcquireAsync(fhs[0], True)
+    await a.ReleaseAsync(fhs[0])
+    result = await a.TxnAsync([], [TxnOp(TxnOp.SET_CONTENT, fhs[1], content="txn")])
+    assert result.succeeded
+    assert await a.GetContentByPathAsync("/aio/1") == b"txn"
+    await a.CloseManyAsync(fhs)
+
+
+async def test_awaitable_errors(cluster: Cluster):
+    """
+    Test that a failed awaitable call raises SkinnyError
+    """
+    a = SkinnyClient()
+    fh = await a.OpenAsync("/test")
+    await a.CloseAsync(fh)
+    with pytest.raises(RuntimeError):
+        await a.GetContentAsync(fh)
+
+
+async def assert_same_outcome(call, call_async):
+    """
+    Check that a blocking call and its awaitable version both raise, or
+    both return the same
+    """
+    try:
+        expected = call()
+    except RuntimeError:
+        with pytest.raises(RuntimeError):
+            await call_async()
+        return
+    assert await call_async() == expected
+
+
+async def test_open_async(cluster: Cluster):
+    a = SkinnyClient()
+    fh = await a.OpenAsync("/aio_open")
+    assert a.GetContent(fh) == b""
+    await assert_same_outcome(lambda: a.Open("/aio_missing/file"),
+                              lambda: a.OpenAsync("/aio_missing/file"))
+
+
+async def test_open_dir_async(cluster: Cluster):
+    a = SkinnyClient()
+    await a.OpenDirAsync("/aio_dir")
+    assert a.Open("/aio_dir/file") >= 0
+    await assert_same_outcome(lambda: a.OpenDir("/aio_missing/dir"),
+                              lambda: a.OpenDirAsync("/aio_missing/dir"))
+
+
+async def test_open_many_async(cluster: Cluster):
+    a = SkinnyClient()
+    fhs = await a.OpenManyAsync(["/aio_many0", "/aio_many1"])
+    assert len(set(fhs)) == 2
+    paths = ["/aio_many2", "/aio_missing/file"]
+    await assert_same_outcome(lambda: a.OpenMany(paths),
+                              lambda: a.OpenManyAsync(paths))
+
+
+async def test_close_async(cluster: Cluster):
+    """
+    Test that closing a closed handle succeeds, as the blocking Close does
+    """
+    a = SkinnyClient()
+    fh = await a.OpenAsync("/aio_close")
+    await a.CloseAsync(fh)
+    await assert_same_outcome(lambda: a.Close(fh), lambda: a.CloseAsync(fh))
+
+
+async def test_close_many_async(cluster: Cluster):
+    a = SkinnyClient()
+    fhs = a.OpenMany(["/aio_close0", "/aio_close1"])
+    await a.CloseManyAsync(fhs)
+    await assert_same_outcome(lambda: a.CloseMany(fhs),
+                              lambda: a.CloseManyAsync(fhs))
+
+
+async def test_get_content_async(cluster: Cluster):
+    a = SkinnyClient()
+    fh = a.Open("/aio_get")
+    a.SetContent(fh, "get")
+    assert await a.GetContentAsync(fh) == b"get"
+    a.Close(fh)
+    await assert_same_outcome(lambda: a.GetContent(fh),
+                              lambda: a.GetContentAsync(fh))
+
+
+async def test_get_content_many_async(cluster: Cluster):
+    a = SkinnyClient()
+    fhs = a.OpenMany(["/aio_get0", "/aio_get1"])
+    a.SetContent(fhs[0], "get0")
+    assert await a.GetContentManyAsync(fhs) == [b"get0", b""]
+    a.Close(fhs[1])
+    await assert_same_outcome(lambda: a.GetContentMany(fhs),
+                              lambda: a.GetContentManyAsync(fhs))
+
+
+async def test_get_content_by_path_async(cluster: Cluster):
+    a = SkinnyClient()
+    a.SetContent(a.Open("/aio_by_path"), "by path")
+    assert await a.GetContentByPathAsync("/aio_by_path") == b"by path"
+    await assert_same_outcome(lambda: a.GetContentByPath("/aio_none"),
+                              lambda: a.GetContentByPathAsync("/aio_none"))
+
+
+async def test_set_content_async(cluster: Cluster):
+    a = SkinnyClient()
+    fh = a.Open("/aio_set")
+    await a.SetContentAsync(fh, "set")
+    assert SkinnyClient().GetContentByPath("/aio_set") == b"set"
+    a.Close(fh)
+    await assert_same_outcome(lambda: a.SetContent(fh, "closed"),
+                              lambda: a.SetContentAsync(fh, "closed"))
+
+
+async def test_compare_and_set_async(cluster: Cluster):
+    a = SkinnyClient()
+    fh = a.Open("/aio_cas")
+    a.SetContent(fh, "cas")
+    _, gen = a.GetContentWithGen(fh)
+    assert await a.CompareAndSetAsync(fh, gen, "swapped")
+    assert a.GetContent(fh) == b"swapped"
+    await assert_same_outcome(lambda: a.CompareAndSet(fh, gen, "stale"),
+                              lambda: a.CompareAndSetAsync(fh, gen, "stale"))
+
+
+async def test_txn_async(cluster: Cluster):
+    a = SkinnyClient()
+    fh = a.Open("/aio_txn")
+    ops = [TxnOp(TxnOp.SET_CONTENT, fh, content="txn")]
+    assert (await a.TxnAsync([], ops)).succeeded
+    assert a.GetContent(fh) == b"txn"
+    a.Close(fh)
+    await assert_same_outcome(lambda: a.Txn([], ops).succeeded,
+                              lambda: succeeded(a.TxnAsync([], ops)))
+
+
+async def succeeded(txn):
+    return (await txn).succeeded
+
+
+async def test_try_acquire_async(cluster: Cluster):
+    a, b = SkinnyClient(), SkinnyClient()
+    fh = a.Open("/aio_try")
+    assert await a.TryAcquireAsync(fh, True)
+    other = b.Open("/aio_try")
+    await assert_same_outcome(lambda: b.TryAcquire(other, True),
+                              lambda: b.TryAcquireAsync(other, True))
+    a.Close(fh)
+    await assert_same_outcome(lambda: a.TryAcquire(fh, True),
+                              lambda: a.TryAcquireAsync(fh, True))
+
+
+async def test_acquire_async(cluster: Cluster):
+    a = SkinnyClient()
+    fh = a.Open("/aio_acquire")
+    assert await a.AcquireAsync(fh, True)
+    a.Release(fh)
+    a.Close(fh)
+    await assert_same_outcome(lambda: a.Acquire(fh, True),
+                              lambda: a.AcquireAsync(fh, True))
+
+
+async def test_release_async(cluster: Cluster):
+    a = SkinnyClient()
+    fh = a.Open("/aio_release")
+    assert a.TryAcquire(fh, True)
+    await a.ReleaseAsync(fh)
+    assert SkinnyClient().TryAcquire(a.Open("/aio_release"), True)
+    a.Close(fh)
+    await assert_same_outcome(lambda: a.Release(fh),
+                              lambda: a.ReleaseAsync(fh))
+
+
+async def test_delete_async(cluster: Cluster):
+    a = SkinnyClient()
+    dir_fh = a.OpenDir("/aio_delete")
+    fh = a.Open("/aio_delete/file")
+    await assert_same_outcome(lambda: a.Delete(dir_fh),
+                              lambda: a.DeleteAsync(dir_fh))
+    await a.DeleteAsync(fh)
+    assert a.GetContentByPath("/aio_delete/file") is None
+    a.Close(dir_fh)
+    await assert_same_outcome(lambda: a.Delete(dir_fh),
+                              lambda: a.DeleteAsync(dir_fh))
@@ -1,7 +1,9 @@
 from skinny_client import SkinnyClient
 from conftest import Cluster
+from collections import defaultdict
 import logging
 import multiprocessing
+import time
 
 
 def clientA(event, no):
@@ -33,6 +35,84 @@ async def test_client_dead(cluster: Cluster):
     assert b.GetContent(bfh) == b"efg"
 
 
+async def test_read_by_path(cluster: Cluster):
+    """
+    Test that a content read by path without opening the file is
+    invalidated when another client writes it
+    """
+    a = SkinnyClient()
+    afh = a.Open("/test")
+    a.SetContent(afh, "abc")
+    b = SkinnyClient()
+    assert b.GetContentByPath("/test") == b"abc"
+    assert b.GetContentByPath("/test") == b"abc"
+    a.SetContent(afh, "efg")
+    assert b.GetContentByPath("/test") == b"efg"
+    assert b.GetContentByPath("/does_not_exist") is None
+
+
+async def test_read_by_path_of_ephemeral(cluster: Cluster):
+    """
+    Test that a content read by path of an ephemeral file is
+    invalidated when its owner's session ends and deletes it
+    """
+    a = SkinnyClient()
+    a.SetContent(a.Open("/service", is_ephemeral=True), "addr")
+    b = SkinnyClient()
+    assert b.GetContentByPath("/service") == b"addr"
+    assert b.GetContentByPath("/service") == b"addr"
+    del a
+    time.sleep(1)
+    assert b.GetContentByPath("/service") is None
+
+
+async def test_read_by_path_after_leader_change(cluster: Cluster):
+    """
+    Test that a content read by path is not served from the cache
+    after the leadership moved to another server while the old
+    leader stayed up, as the new leader has no watch for it
+    """
+    leader_id = cluster.client.GetLeader()
+    a = SkinnyClient()
+    afh = a.Open("/test")
+    a.SetContent(afh, "abc")
+    b = SkinnyClient(preferred_server=leader_id)
+    assert b.GetContentByPath("/test") == b"abc"
+    cluster.client.YieldLeadership()
+    assert cluster.client.GetLeader() not in (-1, leader_id)
+    a.SetContent(afh, "efg")
+    time.sleep(1)
+    assert b.GetContentByPath("/test") == b"efg"
+
+
+async def test_shared_connection(cluster: Cluster):
+    """
+    Test that clients sharing a connection share one cache entry per
+    file and all get callbacks when it is invalidated
+    """
+    counter = defaultdict(int)
+
+    def callback(fh: int):
+        counter[fh] += 1
+
+    a = SkinnyClient(shared_connection=True)
+    b = SkinnyClient(shared_connection=True)
+    afh = a.Open("/test", callback)
+    bfh = b.Open("/test", callback)
+    a.SetContent(afh, "abc")
+    assert a.GetContent(afh) == b"abc"
+    hits = b.GetCacheStats()["hits"]
+    assert b.GetContent(bfh) == b"abc"
+    assert b.GetCacheStats()["hits"] == hits + 1
+    b.SetContent(bfh, "efg")
+    time.sleep(1)
+    assert counter[afh] == 2
+    assert counter[bfh] == 2
+    assert a.GetContent(afh) == b"efg"
+    a.Close(afh)
+    assert b.GetContent(bfh) == b"efg"
+
+
 if __name__ == "__main__":
     import asyncio
 
@@ -1,6 +1,8 @@
-from skinny_client import SkinnyClient
+from skinny_client import EventStream, SkinnyClient, TxnOp
 from conftest import Cluster
 from collections import defaultdict
+import asyncio
+import multiprocessing
 import time
 
 
@@ -42,6 +44,93 @@ async def test_event_dir(cluster: Cluster):
 
     assert counter[applefh] == 1
     assert counter[fruitefh] == 4
+    assert counter[bananafh] == 1
+
+    durianfh = a.Open("/fruit/durian", callback)
+    assert a.Txn([], [TxnOp(TxnOp.DELETE, fh=durianfh)]).succeeded
+    time.sleep(1)
+
+    assert counter[durianfh] == 1
+    assert counter[fruitefh] == 6
+
+
+
+async def test_event_stream(cluster: Cluster):
+    """
+    Test that the events of handles opened with an EventStream can be
+    read with async for
+    """
+    a = SkinnyClient()
+    stream = EventStream()
+    fh = a.Open("/test", stream)
+    dirfh = a.OpenDir("/stream", stream)
+    a.SetContent(fh, "1")
+    a.Open("/stream/child")
+    received = []
+
+    async def read():
+        async for fhs in stream:
+            received.extend(fhs)
+            if len(received) == 2:
+                return
+
+    await asyncio.wait_for(read(), 5)
+    assert sorted(received) == sorted([fh, dirfh])
+    assert stream.Drain() == []
+
+
+async def test_callback_errors(cluster: Cluster):
+    """
+    Test that a callback raising does not stop the delivery of later
+    events
+    """
+    a = SkinnyClient()
+    counter = defaultdict(int)
+
+    def callback(fh: int):
+        counter[fh] += 1
+        raise ValueError("callback failed")
+
+    fh = a.Open("/test", callback)
+    a.SetContent(fh, "1")
+    a.SetContent(fh, "2")
+    time.sleep(1)
+
+    assert counter[fh] == 2
+
+
+def ephemeral_clients(n, ready, stop):
+    clients = [SkinnyClient() for _ in range(n)]
+    for i, c in enumerate(clients):
+        c.Open(f"/storm/{i}", is_ephemeral=True)
+    ready.set()
+    stop.wait()
+
+
+async def test_expiry_storm(cluster: Cluster):
+    """
+    Test that the ephemeral files of many sessions that expire at
+    once are all deleted, and the directory watcher is told
+    """
+    a = SkinnyClient()
+    counter = defaultdict(int)
+
+    def callback(fh: int):
+        counter[fh] += 1
+
+    dirfh = a.OpenDir("/storm", callback)
+    ready, stop = multiprocessing.Event(), multiprocessing.Event()
+    p = multiprocessing.Process(target=ephemeral_clients, args=[200, ready, stop])
+    p.start()
+    ready.wait()
+    assert a.GetContent(dirfh).count(b"\0") == 200
+    p.terminate()
+    notified = counter[dirfh]
+    deadline = time.monotonic() + 20
+    while a.GetContent(dirfh) and time.monotonic() < deadline:
+        time.sleep(0.5)
+    assert a.GetContent(dirfh) == b""
+    assert counter[dirfh] > notified
 
 
 if __name__ == "__main__":
@@ -1,5 +1,8 @@
 from skinny_client import SkinnyClient
 from conftest import Cluster
+import logging
+import pytest
+import time
 
 
 async def test_leader_dead(cluster: Cluster):
@@ -17,3 +20,60 @@ async def test_leader_dead(cluster: Cluster):
     await cluster.start(leader_id)
     await cluster.kill_leader()
     assert a.GetContent(fh) == test_str
+
+
+async def test_failover_time(cluster: Cluster):
+    """
+    Test that a write reaches a newly elected leader well within
+    an election timeout (500ms) of the election, in the best of
+    a few failovers
+    """
+    a = SkinnyClient()
+    fh = a.Open("/test")
+    a.SetContent(fh, "before")
+    failovers = []
+    for i in range(3):
+        old_leader = await cluster.kill_leader()
+        while cluster.client.GetLeader() in (-1, old_leader):
+            time.sleep(0.01)
+        start = time.monotonic()
+        a.SetContent(fh, f"after {i}")
+        failovers.append(time.monotonic() - start)
+        assert a.GetContent(fh) == f"after {i}".encode()
+        await cluster.start(old_leader)
+    logging.info(f"failovers took {failovers} after the elections")
+    assert min(failovers) < 0.5
+
+
+async def test_call_deadline(cluster: Cluster):
+    """
+    Test that a call fails once its deadline passes instead of
+    retrying forever when no server is up
+    """
+    a = SkinnyClient(call_timeout_ms=1000)
+    fh = a.Open("/test")
+    for server in cluster.servers:
+        await server.close()
+    start = time.monotonic()
+    with pytest.raises(RuntimeError):
+        a.SetContent(fh, "unreachable")
+    assert time.monotonic() - start < 2
+
+
+async def test_follower_forwarding(cluster: Cluster):
+    """
+    Test that a client that sticks to a follower can write, lock and
+    read through it, also after the leader it forwards to has crashed
+    """
+    leader_id = cluster.client.GetLeader()
+    follower_id = (leader_id + 1) % len(cluster.servers)
+    a = SkinnyClient(preferred_server=follower_id)
+    b = SkinnyClient()
+    fh = a.Open("/test")
+    assert a.TryAcquire(fh, True)
+    a.SetContent(fh, "via follower")
+    a.Release(fh)
+    assert b.GetContent(b.Open("/test")) == b"via follower"
+    await cluster.servers[leader_id].close()
+    a.SetContent(fh, "after failover")
+    assert a.GetContent(fh) == b"after failover"
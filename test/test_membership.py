@@ -0,0 +1,32 @@
+from skinny_client import SkinnyClient
+from conftest import Cluster, Server, PREFIX, server_addrs
+import asyncssh
+import time
+
+
+async def test_add_remove_learner(join_cluster: Cluster):
+    """
+    Test that a server started with --join becomes a learner of the
+    cluster when added, and leaves it when removed
+    """
+    a = SkinnyClient()
+    fh = a.Open("/test")
+    a.SetContent(fh, b"before join")
+    conn = await asyncssh.connect(server_addrs[0], known_hosts=None)
+    joiner = Server(conn, 3, f"--config /tmp/{PREFIX}cluster_join.conf --join")
+    await joiner.start()
+    time.sleep(1)
+    try:
+        join_cluster.client.AddServer(3, "127.0.0.1", 10230, learner=True)
+        members = {m.id: m for m in join_cluster.client.GetMembers()}
+        assert sorted(members) == [0, 1, 2, 3]
+        assert members[3].learner and members[3].port == 10230
+        assert not members[0].learner
+        # Writes still commit with the learner in the cluster
+        a.SetContent(fh, b"after join")
+        assert a.GetContent(fh) == b"after join"
+        join_cluster.client.RemoveServer(3)
+        members = [m.id for m in join_cluster.client.GetMembers()]
+        assert sorted(members) == [0, 1, 2]
+    finally:
+        await joiner.close()
@@ -0,0 +1,37 @@
+from skinny_client import SkinnyClient
+from conftest import Cluster, Server, PREFIX, server_addrs
+import asyncssh
+import time
+
+
+async def add_observer(cluster: Cluster) -> Server:
+    conn = await asyncssh.connect(server_addrs[0], known_hosts=None)
+    observer = Server(conn, 3, f"--config /tmp/{PREFIX}cluster_join.conf --join")
+    await observer.start()
+    time.sleep(1)
+    cluster.client.AddServer(3, "127.0.0.1", 10230, learner=True)
+    return observer
+
+
+async def test_observer_read_after_write(join_cluster: Cluster):
+    """
+    Test that a client reading from an observer sees every write
+    another client made before, and still reads once the observer
+    is gone
+    """
+    observer = await add_observer(join_cluster)
+    try:
+        a = SkinnyClient()
+        b = SkinnyClient(read_from_observer=True, observer_id=3)
+        fha = a.Open("/test")
+        fhb = b.Open("/test")
+        for i in range(20):
+            a.SetContent(fha, str(i))
+            assert b.GetContent(fhb) == str(i).encode()
+        assert b.GetContentByPath("/test", watch=False) == b"19"
+        await observer.close()
+        a.SetContent(fha, "after observer")
+        assert b.GetContent(fhb) == b"after observer"
+    finally:
+        await observer.close()
+        join_cluster.client.RemoveServer(3)
@@ -3,6 +3,7 @@ import time
 import string
 import random
 from skinny_client import SkinnyClient
+import pytest
 import threading
 
 
@@ -48,6 +49,80 @@ async def test_concurrent_read(cluster):
         i.join()
 
 
+async def test_batch_read_write(cluster):
+    """
+    Test opening, reading and closing many files in one call
+    """
+    a = SkinnyClient()
+    a.OpenDir("/batch")
+    paths = [f"/batch/{i}" for i in range(100)]
+    fhs = a.OpenMany(paths)
+    assert len(set(fhs)) == len(paths)
+    for i, fh in enumerate(fhs[:10]):
+        a.SetContent(fh, str(i))
+
+    b = SkinnyClient()
+    bfhs = b.OpenMany(paths)
+    contents = b.GetContentMany(bfhs)
+    assert contents[:10] == [str(i).encode() for i in range(10)]
+    assert contents[10:] == [b""] * 90
+    b.CloseMany(bfhs)
+    a.CloseMany(fhs)
+
+
+
+async def test_content_view(cluster):
+    """
+    Test reading content as a read-only memoryview, without a copy
+    """
+    a = SkinnyClient()
+    fh = a.Open("/test")
+    a.SetContent(fh, "viewed")
+    view = a.GetContentView(fh)
+    assert view.readonly and bytes(view) == b"viewed"
+
+
+async def test_stale_handle(cluster):
+    """
+    Test that a handle whose slot was reused by a later open is rejected
+    by every call, and that the cluster keeps serving
+    """
+    a = SkinnyClient()
+    stale = a.Open("/stale")
+    a.Close(stale)
+    fh = a.Open("/reopened")
+    assert fh != stale and fh & 0xFFFFF == stale & 0xFFFFF
+    for call in [
+        lambda: a.SetContent(stale, "stale"),
+        lambda: a.GetContent(stale),
+        lambda: a.TryAcquire(stale, True),
+        lambda: a.Acquire(stale, True),
+        lambda: a.Release(stale),
+        lambda: a.Delete(stale),
+    ]:
+        with pytest.raises(RuntimeError):
+            call()
+    a.SetContent(fh, "fresh")
+    assert a.GetContent(fh) == b"fresh"
+    assert SkinnyClient().GetContentByPath("/reopened") == b"fresh"
+
+
+async def test_closed_handle_and_missing_parent(cluster):
+    """
+    Test that reading through a closed handle and opening under a
+    missing directory fail without taking the cluster down
+    """
+    a = SkinnyClient()
+    fh = a.Open("/closed")
+    a.SetContent(fh, "closed")
+    a.Close(fh)
+    with pytest.raises(RuntimeError):
+        a.GetContent(fh)
+    with pytest.raises(RuntimeError):
+        a.Open("/missing/file")
+    assert a.GetContentByPath("/closed") == b"closed"
+
+
 if __name__ == "__main__":
     import asyncio
 
@@ -0,0 +1,58 @@
+from skinny_client import SkinnyClient
+from conftest import Cluster
+import json
+import threading
+import time
+
+
+async def test_stats(cluster: Cluster):
+    """
+    Test that GetStats reports the leader's sessions, handles, sent
+    invalidations and a client waiting for a lock
+    """
+    a = SkinnyClient()
+    b = SkinnyClient()
+    afh = a.Open("/test")
+    bfh = b.Open("/test")
+    leader = cluster.client.GetLeader()
+    before = cluster.client.GetStats(leader)
+    assert before["sessions"] >= 2 and before["open_handles"] >= 2
+    assert before["commit_index"] >= before["applied_index"] > 0
+    assert before["log_size"] > 0 and before["proposals"] > 0
+
+    a.SetContent(afh, b"invalidate")
+    after = cluster.client.GetStats(leader)
+    assert after["invalidations_sent"] > before["invalidations_sent"]
+
+    a.Acquire(afh, True)
+    t = threading.Thread(target=b.Acquire, args=(bfh, True))
+    t.start()
+    time.sleep(1)
+    assert cluster.client.GetStats(leader)["lock_waiters"] == {"/test": 1}
+    a.Release(afh)
+    t.join()
+    assert cluster.client.GetStats(leader)["lock_waiters"] == {}
+
+
+async def test_profile(cluster: Cluster):
+    """
+    Test that a server samples spans of its handlers once profiling is
+    turned on, and exports them as a Chrome trace
+    """
+    a = SkinnyClient()
+    fh = a.Open("/test")
+    leader = cluster.client.GetLeader()
+    cluster.client.SetProfiling(leader, 1)
+    for i in range(10):
+        a.SetContent(fh, b"profiled")
+    cluster.client.SetProfiling(leader, 0)
+    events = json.loads(cluster.client.GetProfile(leader))["traceEvents"]
+    names = {e["name"] for e in events}
+    assert {"SetContent", "append_entries", "commit"} <= names
+    assert all(e["ph"] == "X" and e["dur"] >= 0 for e in events)
+    assert any(e["args"]["allocations"] > 0 for e in events)
+
+    # Off, nothing more is sampled
+    a.SetContent(fh, b"not profiled")
+    after = json.loads(cluster.client.GetProfile(leader))["traceEvents"]
+    assert len(after) == len(events)
@@ -0,0 +1,128 @@
+from skinny_client import SkinnyClient, TxnGuard, TxnOp
+from conftest import Cluster
+import pytest
+import threading
+
+
+async def test_compare_and_set(cluster: Cluster):
+    """
+    Test that CompareAndSet only succeeds against the current
+    content generation
+    """
+    a = SkinnyClient()
+    fh = a.Open("/test")
+    a.SetContent(fh, "abc")
+    content, gen = a.GetContentWithGen(fh)
+    assert content == b"abc"
+    assert a.CompareAndSet(fh, gen, "efg")
+    assert not a.CompareAndSet(fh, gen, "xyz")
+    assert a.GetContentWithGen(fh) == (b"efg", gen + 1)
+
+
+async def test_concurrent_increment(cluster: Cluster):
+    """
+    Test read-modify-write through CompareAndSet from many clients
+    without losing updates
+    """
+    a = SkinnyClient()
+    fh = a.Open("/counter")
+    a.SetContent(fh, "0")
+    NUM_THREADS = 10
+    NUM_INCREMENTS = 10
+
+    def child():
+        c = SkinnyClient()
+        cfh = c.Open("/counter")
+        done = 0
+        while done < NUM_INCREMENTS:
+            content, gen = c.GetContentWithGen(cfh)
+            if c.CompareAndSet(cfh, gen, str(int(content) + 1)):
+                done += 1
+
+    threads = [threading.Thread(target=child) for _ in range(NUM_THREADS)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    assert a.GetContent(fh) == str(NUM_THREADS * NUM_INCREMENTS).encode()
+
+
+async def test_txn_atomic(cluster: Cluster):
+    """
+    Test that a transaction whose guard fails applies none of its ops
+    """
+    a = SkinnyClient()
+    dirfh = a.OpenDir("/txn")
+    res = a.Txn(
+        [TxnGuard(TxnGuard.NOT_EXISTS, path="/txn/a")],
+        [
+            TxnOp(TxnOp.OPEN, path="/txn/a"),
+            TxnOp(TxnOp.OPEN, path="/txn/b"),
+        ],
+    )
+    assert res.succeeded
+    assert len(res.fhs) == 2
+    assert a.GetContent(dirfh) == b"\0a\0b"
+
+    res = a.Txn(
+        [
+            TxnGuard(TxnGuard.EXISTS, path="/txn/a"),
+            TxnGuard(TxnGuard.NOT_EXISTS, path="/txn/a"),
+        ],
+        [TxnOp(TxnOp.DELETE, fh=res.fhs[0])],
+    )
+    assert not res.succeeded
+    assert res.failed_guard == 1
+    assert a.GetContent(dirfh) == b"\0a\0b"
+
+
+async def test_txn_ops_see_earlier_ops(cluster: Cluster):
+    """
+    Test that each op of a transaction is checked against the state the
+    ops before it leave
+    """
+    a = SkinnyClient()
+    dirfh = a.OpenDir("/seq")
+    with pytest.raises(RuntimeError):
+        a.Txn([], [TxnOp(TxnOp.OPEN, path="/seq/x"), TxnOp(TxnOp.DELETE, fh=dirfh)])
+    assert a.GetContent(dirfh) == b""
+
+    fh = a.Open("/seq/f")
+    with pytest.raises(RuntimeError):
+        a.Txn(
+            [],
+            [
+                TxnOp(TxnOp.DELETE, fh=fh),
+                TxnOp(TxnOp.SET_CONTENT, path="/seq/f", content="freed"),
+            ],
+        )
+    res = a.Txn(
+        [],
+        [
+            TxnOp(TxnOp.DELETE, fh=fh),
+            TxnOp(TxnOp.OPEN, path="/seq/f"),
+            TxnOp(TxnOp.SET_CONTENT, path="/seq/f", content="recreated"),
+        ],
+    )
+    assert res.succeeded
+    assert a.GetContentByPath("/seq/f") == b"recreated"
+
+
+async def test_guard_after_recreate(cluster: Cluster):
+    """
+    Test that a content generation guard taken before a file was deleted
+    does not hold once the file is created again
+    """
+    a = SkinnyClient()
+    fh = a.Open("/aba")
+    _, gen = a.GetContentWithGen(fh)
+    a.Delete(fh)
+    b = SkinnyClient()
+    bfh = b.Open("/aba")
+    assert not a.CompareAndSet(fh, gen, "stale")
+    res = a.Txn(
+        [TxnGuard(TxnGuard.CONTENT_GEN_EQ, path="/aba", value=gen)],
+        [TxnOp(TxnOp.SET_CONTENT, path="/aba", content="stale")],
+    )
+    assert not res.succeeded
+    assert b.GetContent(bfh) == b""
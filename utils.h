@@ -1,6 +1,18 @@
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <tuple>
+#include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -8,13 +20,55 @@
 
 std::string host_suffix{".skinnyclient.advosuwmadison-pg0.clemson.cloudlab.us"};
 
-// GRPC will be using raft port + 1
-static const std::vector<std::tuple<std::string, int>> SRV_CONFIG{
-    {"node0" + host_suffix, 10200}, {"node1" + host_suffix, 12010},
-    {"node2" + host_suffix, 10220}, {"node3" + host_suffix, 10220},
-    {"node4" + host_suffix, 10220},
+struct ServerConfig {
+  int id;  // Raft server id
+  std::string host;
+  int port;              // Raft port. GRPC will be using raft port + 1
+  bool learner = false;  // non-voting
 };
 
+// Reads a cluster config file with one server per line:
+//   <id> <host> <raft port> [learner]
+// Blank lines and lines starting with '#' are skipped.
+inline std::vector<ServerConfig> load_cluster_config(const std::string &path) {
+  std::ifstream in(path);
+  if (!in) throw std::runtime_error("Cannot read cluster config " + path);
+  std::vector<ServerConfig> config;
+  std::string line;
+  while (std::getline(in, line)) {
+    auto first = line.find_first_not_of(" \t");
+    if (first == std::string::npos || line[first] == '#') continue;
+    std::istringstream fields(line);
+    ServerConfig server;
+    if (!(fields >> server.id >> server.host >> server.port)) {
+      throw std::runtime_error("Bad line in cluster config: " + line);
+    }
+    std::string role;
+    server.learner = (fields >> role) && role == "learner";
+    config.push_back(std::move(server));
+  }
+  return config;
+}
+
+// Host and port of a Raft endpoint "<host>:<port>"
+inline std::pair<std::string, int> split_endpoint(const std::string &endpoint) {
+  auto colon = endpoint.rfind(':');
+  return {endpoint.substr(0, colon), std::stoi(endpoint.substr(colon + 1))};
+}
+
+// Servers of the cell: the file named by $SKINNY_CONFIG, else the CloudLab
+// nodes. The server's --config flag replaces it before anything reads it.
+inline std::vector<ServerConfig> SRV_CONFIG = []() {
+  if (const char *path = std::getenv("SKINNY_CONFIG")) {
+    return load_cluster_config(path);
+  }
+  return std::vector<ServerConfig>{
+      {0, "node0" + host_suffix, 10200}, {1, "node1" + host_suffix, 12010},
+      {2, "node2" + host_suffix, 10220}, {3, "node3" + host_suffix, 10220},
+      {4, "node4" + host_suffix, 10220},
+  };
+}();
+
 namespace skinny {
 enum class ErrorCode { NOT_LEADER = 100, LOCK_RELATED = 101 };
 }
@@ -33,6 +87,9 @@ class FileMetaData {
   std::mutex mutex;
   std::condition_variable cv;
   std::unordered_map<int, int> subscribers;  // sessionid: fh
+  // Sessions that read this file by path. Leader memory only, not replicated.
+  std::mutex watchers_mutex;
+  std::unordered_set<int> path_watchers;
 
   bool file_exists;
   int instance_num;
@@ -42,9 +99,60 @@ class FileMetaData {
   bool is_ephemeral;
 };
 
-using DataStore =
-    std::unordered_map<std::string, std::pair<FileMetaData, std::string>>;
+class DataStore
+    : public std::unordered_map<std::string,
+                                std::pair<FileMetaData, std::string>> {
+ public:
+  // Held exclusively while a log entry is applied. Readers holding it shared
+  // see the state between two entries.
+  std::shared_mutex apply_lock;
+
+  // Called by the state machine after it applied entry `log_idx`
+  void set_applied(uint64_t log_idx) {
+    {
+      std::lock_guard lg(applied_mutex_);
+      applied_idx_ = log_idx;
+    }
+    applied_cv_.notify_all();
+  }
+  // Whether entry `log_idx` was applied by `deadline`
+  bool wait_applied(uint64_t log_idx,
+                    std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock ul(applied_mutex_);
+    return applied_cv_.wait_until(
+        ul, deadline, [&] { return applied_idx_ >= log_idx; });
+  }
+
+  // Acquire calls blocked on the lock of `key`, kept for GetStats so that it
+  // need not walk every file
+  void add_lock_waiters(const std::string &key, int delta) {
+    std::lock_guard lg(waiters_mutex_);
+    if ((lock_waiters_[key] += delta) == 0) lock_waiters_.erase(key);
+  }
+  // (waiters, path) of every path with some
+  std::vector<std::pair<int, std::string>> lock_waiters() {
+    std::lock_guard lg(waiters_mutex_);
+    std::vector<std::pair<int, std::string>> waiters;
+    waiters.reserve(lock_waiters_.size());
+    for (auto &[key, n] : lock_waiters_) waiters.emplace_back(n, key);
+    return waiters;
+  }
+
+ private:
+  std::mutex waiters_mutex_;
+  std::unordered_map<std::string, int> lock_waiters_;
+  std::mutex applied_mutex_;
+  std::condition_variable applied_cv_;
+  uint64_t applied_idx_ = 0;
+};
 
 const std::string SESSION_NOT_FOUND_STR = "Session Not Found";
 const grpc::Status SESSION_NOT_FOUND_STATUS =
-    grpc::Status(grpc::StatusCode::CANCELLED, SESSION_NOT_FOUND_STR);
\ No newline at end of file
+    grpc::Status(grpc::StatusCode::CANCELLED, SESSION_NOT_FOUND_STR);
+// A file handle the session never had, or one whose slot was reused
+const std::string INVALID_HANDLE_STR = "Invalid file handle";
+const grpc::Status INVALID_HANDLE_STATUS =
+    grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, INVALID_HANDLE_STR);
+// An observer has not applied the log as far as a read needs
+const grpc::Status OBSERVER_BEHIND_STATUS =
+    grpc::Status(grpc::StatusCode::UNAVAILABLE, "Observer is behind");